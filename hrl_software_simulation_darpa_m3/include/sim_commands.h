@@ -0,0 +1,119 @@
+#ifndef SIM_COMMANDS_H
+#define SIM_COMMANDS_H
+
+#include <vector>
+#include <algorithm>
+#include <boost/thread/mutex.hpp>
+
+// equilibrium angles and impedance of the joints. The torque loop
+// always uses the three of one command.
+struct JointCommand
+{
+    std::vector<double> jep;
+    std::vector<double> k_p;
+    std::vector<double> k_d;
+
+    void resize(int n)
+    {
+        jep.assign(n, 0.);
+        k_p.assign(n, 0.);
+        k_d.assign(n, 0.);
+    }
+};
+
+// hands joint commands from the ROS callbacks to the physics loop
+// through three buffers (triple buffering). The writer fills the back
+// buffer and swaps it with the middle one, the reader swaps the middle
+// buffer with its front one when a new command is there. The swaps are
+// one atomic exchange of the middle index, so the reader never waits
+// and always sees a whole command. Writers only lock against each
+// other, as a jep and an impedance message each change part of the
+// command.
+class CommandBuffer
+{
+    public:
+        CommandBuffer() : num_jts(0), back(0), middle(1), front(2) {}
+
+        // all buffers to n joints, zero.
+        void init(int n)
+        {
+            boost::mutex::scoped_lock lock(write_lock);
+            num_jts = n;
+            latest.resize(n);
+            for (int i = 0; i < 3; i++)
+                buffers[i].resize(n);
+        }
+
+        // writer: new jep, the impedance is kept. False if the size
+        // does not match the number of joints.
+        bool set_jep(const std::vector<double> &jep)
+        {
+            if ((int)jep.size() != num_jts)
+                return false;
+            boost::mutex::scoped_lock lock(write_lock);
+            std::copy(jep.begin(), jep.end(), latest.jep.begin());
+            publish();
+            return true;
+        }
+
+        // writer: new impedance, the jep is kept. An empty k_p or k_d
+        // keeps that one too.
+        bool set_impedance(const std::vector<double> &k_p, const std::vector<double> &k_d)
+        {
+            if ((!k_p.empty() && (int)k_p.size() != num_jts) ||
+                (!k_d.empty() && (int)k_d.size() != num_jts))
+                return false;
+            boost::mutex::scoped_lock lock(write_lock);
+            std::copy(k_p.begin(), k_p.end(), latest.k_p.begin());
+            std::copy(k_d.begin(), k_d.end(), latest.k_d.begin());
+            publish();
+            return true;
+        }
+
+        // reader: true if a command was written since the last call,
+        // it is then in current().
+        bool update()
+        {
+            if ((middle & FRESH) == 0)
+                return false;
+            front = exchange(middle, front) & INDEX;
+            return true;
+        }
+
+        // reader: the command of the last update.
+        const JointCommand &current() const { return buffers[front]; }
+
+    protected:
+        enum { INDEX = 3, FRESH = 4 };
+
+        // the buffers have their size from init, so this does not
+        // allocate.
+        void publish()
+        {
+            JointCommand &b = buffers[back];
+            std::copy(latest.jep.begin(), latest.jep.end(), b.jep.begin());
+            std::copy(latest.k_p.begin(), latest.k_p.end(), b.k_p.begin());
+            std::copy(latest.k_d.begin(), latest.k_d.end(), b.k_d.begin());
+            back = exchange(middle, back | FRESH) & INDEX;
+        }
+
+        // atomic exchange, also a full memory barrier.
+        static int exchange(volatile int &v, int x)
+        {
+            int old = v;
+            int seen;
+            while ((seen = __sync_val_compare_and_swap(&v, old, x)) != old)
+                old = seen;
+            return old;
+        }
+
+        int num_jts;
+        JointCommand buffers[3];
+        JointCommand latest; // all parts written so far (writers)
+        int back; // writers
+        volatile int middle; // index | FRESH
+        int front; // reader
+        boost::mutex write_lock;
+};
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef SIM_HANDOFF_H
+#define SIM_HANDOFF_H
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+// hands snapshots from the physics loop to one worker thread through
+// two buffers. The physics loop fills the buffer the worker is not
+// reading and never waits for the worker: if the worker is still
+// busy, a newer snapshot replaces the one that is waiting (which is
+// dropped). The lock is only held to swap buffer indices, never while
+// a snapshot is filled or processed.
+template <class T>
+class SnapshotHandoff
+{
+    public:
+        SnapshotHandoff() : pending(-1), busy(-1), filling(0), stopped(false),
+            num_handed(0), num_dropped(0) {}
+
+        // buffer for the next snapshot: the one still waiting for the
+        // worker if there is one (replaced is then set, the waiting
+        // snapshot is dropped), else the one the worker is not reading.
+        T &write_buffer(bool &replaced)
+        {
+            boost::mutex::scoped_lock lock(m);
+            replaced = (pending >= 0);
+            if (replaced)
+            {
+                filling = pending;
+                pending = -1;
+                num_dropped++;
+            }
+            else
+                filling = (busy == 0) ? 1 : 0;
+            return buffers[filling];
+        }
+
+        // the buffer from write_buffer is ready for the worker.
+        void publish()
+        {
+            {
+                boost::mutex::scoped_lock lock(m);
+                pending = filling;
+                num_handed++;
+            }
+            cond.notify_one();
+        }
+
+        // worker: blocks until a snapshot is ready, NULL once stopped.
+        T *take()
+        {
+            boost::mutex::scoped_lock lock(m);
+            while (pending < 0 && stopped == false)
+                cond.wait(lock);
+            if (stopped == true)
+                return NULL;
+            busy = pending;
+            pending = -1;
+            return &buffers[busy];
+        }
+
+        // worker: done with the snapshot from take.
+        void release()
+        {
+            boost::mutex::scoped_lock lock(m);
+            busy = -1;
+        }
+
+        void stop()
+        {
+            {
+                boost::mutex::scoped_lock lock(m);
+                stopped = true;
+            }
+            cond.notify_all();
+        }
+
+        // snapshots handed over and dropped since the last call.
+        void stats(long &handed, long &dropped)
+        {
+            boost::mutex::scoped_lock lock(m);
+            handed = num_handed;
+            dropped = num_dropped;
+            num_handed = 0;
+            num_dropped = 0;
+        }
+
+    protected:
+        T buffers[2];
+        int pending; // buffer waiting for the worker, -1 if none
+        int busy; // buffer the worker is reading, -1 if none
+        int filling; // buffer the physics loop writes
+        bool stopped;
+        long num_handed;
+        long num_dropped;
+        boost::mutex m;
+        boost::condition_variable cond;
+};
+
+#endif
@@ -0,0 +1,266 @@
+#ifndef SIM_OBSTACLES_H
+#define SIM_OBSTACLES_H
+
+#include <ode/ode.h>
+#include <vector>
+#include <cmath>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// critically damped spring of the compliant obstacles,
+//   f = (home - pos)*stiffness - vel*damping
+// for x and y of n obstacles. Two obstacles per SSE2 instruction,
+// the results are the same as for the scalar code.
+inline void compliant_spring_forces(int n, const double *home_x, const double *home_y,
+        const double *stiffness, const double *damping,
+        const double *pos_x, const double *pos_y, const double *vel_x, const double *vel_y,
+        double *f_x, double *f_y)
+{
+    int i = 0;
+#ifdef __SSE2__
+    for (; i+2 <= n; i += 2)
+    {
+        __m128d k = _mm_loadu_pd(stiffness+i);
+        __m128d d = _mm_loadu_pd(damping+i);
+        __m128d fx = _mm_sub_pd(_mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(home_x+i), _mm_loadu_pd(pos_x+i)), k),
+                _mm_mul_pd(_mm_loadu_pd(vel_x+i), d));
+        __m128d fy = _mm_sub_pd(_mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(home_y+i), _mm_loadu_pd(pos_y+i)), k),
+                _mm_mul_pd(_mm_loadu_pd(vel_y+i), d));
+        _mm_storeu_pd(f_x+i, fx);
+        _mm_storeu_pd(f_y+i, fy);
+    }
+#endif
+    for (; i < n; i++)
+    {
+        f_x[i] = (home_x[i]-pos_x[i])*stiffness[i] - vel_x[i]*damping[i];
+        f_y[i] = (home_y[i]-pos_y[i])*stiffness[i] - vel_y[i]*damping[i];
+    }
+}
+
+// Obstacles of a scene (structure of arrays). Movable and compliant
+// obstacles share one index, movable ones first:
+//   [0, num_movable)                      movable
+//   [num_movable, num_movable+num_compliant) compliant
+// which is also their order in the BodyDraw message. The arrays are
+// sized when the obstacles are created, so the per step loops walk
+// through contiguous memory and a scene is only limited by memory.
+struct ObstacleStore
+{
+    int num_movable;
+    int num_compliant;
+    int num_fixed;
+
+    // movable and compliant obstacles
+    std::vector<dBodyID> body;
+    std::vector<dJointID> plane2d_joint;
+    // ODE writes the joint forces here, must not be resized once
+    // the joints are created.
+    std::vector<dJointFeedback> plane2d_feedback;
+    std::vector<double> friction_limit; // max friction force [N]
+    std::vector<double> home_x; // compliant obstacles are pulled back here
+    std::vector<double> home_y;
+    std::vector<double> home_z;
+    std::vector<double> stiffness;
+    std::vector<double> damping;
+    std::vector<double> radius; // of the capsule [m]
+    // body data of the obstacle bodies, set once the arrays have
+    // their final size.
+    std::vector<int> index;
+    // set by nearCallback when the obstacle touched something in
+    // this step, cleared by the friction update.
+    std::vector<char> dirty;
+    // the friction params of the joint are the defaults (no force
+    // on the obstacle).
+    std::vector<char> default_friction;
+    // state gathered from ODE for the compliant spring kernel.
+    std::vector<double> pos_x;
+    std::vector<double> pos_y;
+    std::vector<double> vel_x;
+    std::vector<double> vel_y;
+    std::vector<double> force_x;
+    std::vector<double> force_y;
+
+    // fixed obstacles (static geoms, no body)
+    std::vector<dGeomID> fixed_geom;
+    std::vector<double> fixed_radius; // capsule radius, half thickness of a wall [m]
+
+    ObstacleStore() : num_movable(0), num_compliant(0), num_fixed(0) {}
+
+    int num_dynamic() const { return num_movable + num_compliant; }
+
+    void resize_dynamic(int n_movable, int n_compliant)
+    {
+        num_movable = n_movable;
+        num_compliant = n_compliant;
+        int n = num_dynamic();
+        body.resize(n, 0);
+        plane2d_joint.resize(n, 0);
+        plane2d_feedback.resize(n);
+        friction_limit.resize(n, 0.);
+        home_x.resize(n, 0.);
+        home_y.resize(n, 0.);
+        home_z.resize(n, 0.);
+        stiffness.resize(n, 0.);
+        damping.resize(n, 0.);
+        radius.resize(n, 0.);
+        index.resize(n, 0);
+        dirty.resize(n, 1);
+        default_friction.resize(n, 0);
+        pos_x.resize(n, 0.);
+        pos_y.resize(n, 0.);
+        vel_x.resize(n, 0.);
+        vel_y.resize(n, 0.);
+        force_x.resize(n, 0.);
+        force_y.resize(n, 0.);
+    }
+
+    // gathers the state of the compliant obstacles, computes their
+    // spring forces in one pass and adds them to the (enabled)
+    // bodies. Disabled obstacles get no force.
+    void apply_compliant_forces()
+    {
+        int c0 = num_movable;
+        int n = num_dynamic();
+        for (int c = c0; c < n; c++)
+        {
+            const dReal *p = dBodyGetPosition(body[c]);
+            const dReal *v = dBodyGetLinearVel(body[c]);
+            pos_x[c] = p[0];
+            pos_y[c] = p[1];
+            vel_x[c] = v[0];
+            vel_y[c] = v[1];
+        }
+
+        compliant_spring_forces(num_compliant, &home_x[c0], &home_y[c0], &stiffness[c0], &damping[c0],
+                &pos_x[c0], &pos_y[c0], &vel_x[c0], &vel_y[c0], &force_x[c0], &force_y[c0]);
+
+        for (int c = c0; c < n; c++)
+        {
+            if (dBodyIsEnabled(body[c]))
+                dBodyAddForce(body[c], force_x[c], force_y[c], 0);
+        }
+    }
+
+    void resize_fixed(int n_fixed)
+    {
+        num_fixed = n_fixed;
+        fixed_geom.resize(n_fixed, 0);
+        fixed_radius.resize(n_fixed, 0.);
+    }
+};
+
+// uniform grid over the xy positions of the obstacles, for the
+// proximity sensor. Items are the obstacles (movable and compliant
+// with their index, fixed ones after them). Cells are hashed into a
+// fixed number of buckets and an item only changes its bucket when
+// it moves to another cell, so updates do not allocate once the
+// buckets have grown.
+struct ObstacleGrid
+{
+    double cell_size;
+    double max_radius;
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<double> radius;
+    std::vector<int> cell_x;
+    std::vector<int> cell_y;
+    std::vector<int> slot; // position of the item in its bucket
+    std::vector<std::vector<int> > buckets;
+
+    ObstacleGrid() : cell_size(1.), max_radius(0.) {}
+
+    void init(double cell, int n_items)
+    {
+        cell_size = cell;
+        max_radius = 0.;
+        x.assign(n_items, 0.);
+        y.assign(n_items, 0.);
+        radius.assign(n_items, 0.);
+        cell_x.assign(n_items, 0);
+        cell_y.assign(n_items, 0);
+        slot.assign(n_items, -1);
+        int n_buckets = 16;
+        while (n_buckets < 2*n_items)
+            n_buckets *= 2;
+        buckets.assign(n_buckets, std::vector<int>());
+    }
+
+    int size() const { return x.size(); }
+
+    void set_radius(int i, double r)
+    {
+        radius[i] = r;
+        if (r > max_radius)
+            max_radius = r;
+    }
+
+    // new position of item i.
+    void set(int i, double px, double py)
+    {
+        x[i] = px;
+        y[i] = py;
+        int cx = cell(px);
+        int cy = cell(py);
+        if (slot[i] >= 0 && cx == cell_x[i] && cy == cell_y[i])
+            return;
+
+        if (slot[i] >= 0)
+        {
+            std::vector<int> &b = buckets[bucket(cell_x[i], cell_y[i])];
+            int last = b.back();
+            b[slot[i]] = last;
+            slot[last] = slot[i];
+            b.pop_back();
+        }
+        cell_x[i] = cx;
+        cell_y[i] = cy;
+        std::vector<int> &b = buckets[bucket(cx, cy)];
+        slot[i] = b.size();
+        b.push_back(i);
+    }
+
+    // items whose surface may be within range of (px, py) and whose
+    // center is in front of the half plane through (px, py) with
+    // normal (nx, ny). Cells entirely behind it are skipped.
+    void query(double px, double py, double nx, double ny, double range, std::vector<int> &out) const
+    {
+        out.clear();
+        double r = range + max_radius;
+        int cx0 = cell(px - r);
+        int cx1 = cell(px + r);
+        int cy0 = cell(py - r);
+        int cy1 = cell(py + r);
+        for (int cx = cx0; cx <= cx1; cx++)
+        {
+            for (int cy = cy0; cy <= cy1; cy++)
+            {
+                // farthest corner of the cell along the normal.
+                double fx = (nx > 0 ? cx+1 : cx)*cell_size - px;
+                double fy = (ny > 0 ? cy+1 : cy)*cell_size - py;
+                if (fx*nx + fy*ny < 0)
+                    continue;
+
+                const std::vector<int> &b = buckets[bucket(cx, cy)];
+                for (unsigned int k = 0; k < b.size(); k++)
+                {
+                    // other cells can share the bucket.
+                    int i = b[k];
+                    if (cell_x[i] == cx && cell_y[i] == cy)
+                        out.push_back(i);
+                }
+            }
+        }
+    }
+
+    protected:
+        int cell(double v) const { return (int)floor(v/cell_size); }
+
+        int bucket(int cx, int cy) const
+        {
+            unsigned int h = ((unsigned int)cx*73856093u) ^ ((unsigned int)cy*19349663u);
+            return h & (buckets.size()-1);
+        }
+};
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef SIM_PROFILER_H
+#define SIM_PROFILER_H
+
+#include <time.h>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// Timing of the phases of a physics step (collision, solver, ...).
+// Each phase gets a histogram of its durations that is evaluated and
+// cleared once per report window. Define SIM_NO_PROFILING to compile
+// the timers out, SIM_PROFILE then expands to nothing.
+
+inline double profiler_now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+// log scale histogram, 4 bins per octave from 0.1 us on (the bins
+// are at most 25% wide), up to about 15 hours.
+struct DurationHistogram
+{
+    enum { NUM_BINS = 160 };
+
+    long bins[NUM_BINS];
+    long num;
+    double total;
+    double max;
+
+    DurationHistogram() { clear(); }
+
+    void clear()
+    {
+        std::fill(bins, bins+NUM_BINS, 0);
+        num = 0;
+        total = 0.;
+        max = 0.;
+    }
+
+    void add(double dt)
+    {
+        bins[bin(dt)]++;
+        num++;
+        total += dt;
+        if (dt > max)
+            max = dt;
+    }
+
+    double mean() const { return num > 0 ? total/num : 0.; }
+
+    // upper edge of the bin of the q-quantile (q in [0, 1]), never
+    // more than the max.
+    double quantile(double q) const
+    {
+        if (num == 0)
+            return 0.;
+        long rank = (long)ceil(q*num);
+        if (rank < 1)
+            rank = 1;
+        long seen = 0;
+        for (int b = 0; b < NUM_BINS; b++)
+        {
+            seen += bins[b];
+            if (seen >= rank)
+                return std::min(upper_edge(b), max);
+        }
+        return max;
+    }
+
+    static int bin(double dt)
+    {
+        double r = dt/unit();
+        if (r < 1.)
+            return 0;
+        int e;
+        double m = frexp(r, &e); // r = m*2^e, m in [0.5, 1)
+        int b = 4*e + (int)((m-0.5)*8);
+        return std::min(b, (int)NUM_BINS-1);
+    }
+
+    static double upper_edge(int b)
+    {
+        if (b < 4)
+            return unit();
+        return unit()*ldexp(1. + (b%4 + 1)/4., b/4 - 1);
+    }
+
+    static double unit() { return 1e-7; }
+};
+
+// phases and per step counters of one window. Only the thread that
+// steps the physics records.
+class SimProfiler
+{
+    public:
+        SimProfiler() : num_steps(0), contacts(0), rows(0), max_contacts(0), max_rows(0) {}
+
+        // returns the id of the phase.
+        int add_phase(const std::string &name)
+        {
+            names.push_back(name);
+            hist.push_back(DurationHistogram());
+            return names.size()-1;
+        }
+
+        void record(int phase, double dt) { hist[phase].add(dt); }
+
+        // contact joints and constraint rows of one step.
+        void count_step(int num_contacts, int num_rows)
+        {
+            num_steps++;
+            contacts += num_contacts;
+            rows += num_rows;
+            max_contacts = std::max(max_contacts, num_contacts);
+            max_rows = std::max(max_rows, num_rows);
+        }
+
+        int num_phases() const { return names.size(); }
+        const std::string &phase_name(int phase) const { return names[phase]; }
+        const DurationHistogram &phase(int phase) const { return hist[phase]; }
+
+        double mean_contacts() const { return num_steps > 0 ? (double)contacts/num_steps : 0.; }
+        double mean_rows() const { return num_steps > 0 ? (double)rows/num_steps : 0.; }
+
+        // starts the next window.
+        void clear()
+        {
+            for (unsigned int i = 0; i < hist.size(); i++)
+                hist[i].clear();
+            num_steps = 0;
+            contacts = 0;
+            rows = 0;
+            max_contacts = 0;
+            max_rows = 0;
+        }
+
+        long num_steps;
+        long contacts;
+        long rows;
+        int max_contacts;
+        int max_rows;
+
+    protected:
+        std::vector<std::string> names;
+        std::vector<DurationHistogram> hist;
+};
+
+// times the rest of the enclosing block as a phase.
+class ProfileScope
+{
+    public:
+        ProfileScope(SimProfiler &p, int phase_id) : profiler(p), phase(phase_id), t_start(profiler_now()) {}
+        ~ProfileScope() { profiler.record(phase, profiler_now() - t_start); }
+
+    protected:
+        SimProfiler &profiler;
+        int phase;
+        double t_start;
+};
+
+#define SIM_PROFILE_CAT2(a, b) a##b
+#define SIM_PROFILE_CAT(a, b) SIM_PROFILE_CAT2(a, b)
+
+#ifdef SIM_NO_PROFILING
+#define SIM_PROFILE(profiler, phase)
+#else
+#define SIM_PROFILE(profiler, phase) ProfileScope SIM_PROFILE_CAT(profile_scope_, __LINE__)(profiler, phase)
+#endif
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef SIM_PUBLISH_H
+#define SIM_PUBLISH_H
+
+#include <ros/ros.h>
+#include <tf/transform_broadcaster.h>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/bind.hpp>
+#include <vector>
+#include <string>
+
+// how the publish thread sends a queued message.
+template <class M>
+inline void deliver(ros::Publisher &pub, const M &msg) { pub.publish(msg); }
+
+inline void deliver(tf::TransformBroadcaster &br, const tf::StampedTransform &t) { br.sendTransform(t); }
+
+class PublishQueueBase
+{
+    public:
+        PublishQueueBase(const std::string &queue_name) :
+            name(queue_name), direct(true), num_dropped(0), max_depth(0) {}
+        virtual ~PublishQueueBase() {}
+
+        // sends the queued messages, returns how many.
+        virtual int drain() = 0;
+        virtual int depth() const = 0;
+
+        std::string name;
+        // publish right away, without the thread (before the
+        // publish thread is started).
+        bool direct;
+        long num_dropped; // written by the producer
+        int max_depth;
+};
+
+// single producer, single consumer ring of messages for the publish
+// thread. The slots are allocated once and copied into, so that
+// after the first rounds the producer neither allocates nor waits.
+// If the ring is full the message is dropped and counted. Each queue
+// must only be written by one thread.
+template <class M, class Sender = ros::Publisher>
+class PublishQueue : public PublishQueueBase
+{
+    public:
+        PublishQueue(const std::string &queue_name = "", int capacity = 64) :
+            PublishQueueBase(queue_name), slots(capacity), head(0), tail(0) {}
+
+        // producer.
+        void publish(Sender &sender, const M &msg)
+        {
+            if (direct == true)
+            {
+                deliver(sender, msg);
+                return;
+            }
+
+            unsigned long h = head;
+            int d = h - tail;
+            if (d >= (int)slots.size())
+            {
+                num_dropped++;
+                return;
+            }
+            if (d+1 > max_depth)
+                max_depth = d+1;
+
+            Slot &s = slots[h % slots.size()];
+            s.sender = &sender;
+            s.msg = msg;
+            // the slot is written before it is handed over.
+            __sync_synchronize();
+            head = h+1;
+        }
+
+        // consumer.
+        int drain()
+        {
+            int n = 0;
+            unsigned long t = tail;
+            while (t != head)
+            {
+                __sync_synchronize();
+                Slot &s = slots[t % slots.size()];
+                deliver(*s.sender, s.msg);
+                __sync_synchronize();
+                tail = ++t;
+                n++;
+            }
+            return n;
+        }
+
+        int depth() const { return head - tail; }
+
+    protected:
+        struct Slot
+        {
+            Slot() : sender(NULL) {}
+            Sender *sender;
+            M msg;
+        };
+        std::vector<Slot> slots;
+        volatile unsigned long head; // producer
+        volatile unsigned long tail; // consumer
+};
+
+// thread that sends the messages of a set of queues. The producers
+// only wake it up (without a lock); should a wake up be missed, it
+// looks at the queues again after a millisecond anyway.
+class PublishThread
+{
+    public:
+        PublishThread() : running(false), stopped(false) {}
+        ~PublishThread() { stop(); }
+
+        void add(PublishQueueBase &q) { queues.push_back(&q); }
+
+        void start()
+        {
+            if (running == true)
+                return;
+            for (unsigned int i = 0; i < queues.size(); i++)
+                queues[i]->direct = false;
+            reported_drops.assign(queues.size(), 0);
+            running = true;
+            thread = boost::thread(boost::bind(&PublishThread::run, this));
+        }
+
+        // sends what is still queued and joins the thread.
+        void stop()
+        {
+            if (running == false)
+                return;
+            {
+                boost::mutex::scoped_lock lock(m);
+                stopped = true;
+            }
+            cond.notify_one();
+            thread.join();
+            running = false;
+        }
+
+        void wake() { cond.notify_one(); }
+
+        bool is_running() const { return running; }
+
+        // depth and drops of each queue since the last call. The
+        // counters are read without a lock, so they are approximate.
+        void report()
+        {
+            for (unsigned int i = 0; i < queues.size(); i++)
+            {
+                PublishQueueBase &q = *queues[i];
+                long dropped = q.num_dropped;
+                ROS_INFO("publish queue %s: depth %d (max %d), %ld dropped \n",
+                        q.name.c_str(), q.depth(), q.max_depth, dropped - reported_drops[i]);
+                reported_drops[i] = dropped;
+                q.max_depth = 0;
+            }
+        }
+
+    protected:
+        void run()
+        {
+            while (true)
+            {
+                int n = 0;
+                for (unsigned int i = 0; i < queues.size(); i++)
+                    n += queues[i]->drain();
+                if (n > 0)
+                    continue;
+
+                boost::mutex::scoped_lock lock(m);
+                if (stopped == true)
+                    break;
+                cond.timed_wait(lock, boost::posix_time::milliseconds(1));
+            }
+            for (unsigned int i = 0; i < queues.size(); i++)
+                queues[i]->drain();
+        }
+
+        std::vector<PublishQueueBase*> queues;
+        std::vector<long> reported_drops;
+        bool running;
+        bool stopped;
+        boost::thread thread;
+        boost::mutex m;
+        boost::condition_variable cond;
+};
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef SIM_SCENARIO_H
+#define SIM_SCENARIO_H
+
+#include "ros/ros.h"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+
+// Scenario files let a Simulator be set up without the parameter
+// server. A scenario is the XML-RPC encoding of the parameters that
+// would otherwise be on the param server, e.g.
+// {'m3': {'software_testbed': {...}}, 'use_prox_sensor': False}
+// (see save_scenario.py).
+
+// reads an XML-RPC encoded value from a file. Anything before the
+// first <value> tag (e.g. the <params><param> wrapper written by
+// xmlrpclib.dumps) is skipped.
+inline bool load_scenario_file(const std::string &file_name, XmlRpc::XmlRpcValue &scenario)
+{
+    std::ifstream f(file_name.c_str());
+    if (!f.good())
+        return false;
+
+    std::stringstream ss;
+    ss << f.rdbuf();
+    std::string xml = ss.str();
+
+    size_t start = xml.find("<value>");
+    if (start == std::string::npos)
+        return false;
+
+    int offset = 0;
+    xml = xml.substr(start);
+    return scenario.fromXml(xml, &offset);
+}
+
+// looks up a param server style name (e.g.
+// "/m3/software_testbed/num_fixed") in a scenario. Returns NULL if
+// the name does not exist.
+inline XmlRpc::XmlRpcValue *find_scenario_param(XmlRpc::XmlRpcValue &scenario, const std::string &name)
+{
+    XmlRpc::XmlRpcValue *v = &scenario;
+    std::stringstream ss(name);
+    std::string key;
+
+    while (std::getline(ss, key, '/'))
+    {
+        if (key.empty())
+            continue;
+        if (v->getType() != XmlRpc::XmlRpcValue::TypeStruct || !v->hasMember(key))
+            return NULL;
+        v = &(*v)[key];
+    }
+    return v;
+}
+
+// conversions that follow ros::NodeHandle::getParam, i.e. ints are
+// accepted where a double is asked for.
+inline bool scenario_value(XmlRpc::XmlRpcValue &v, XmlRpc::XmlRpcValue &value)
+{
+    value = v;
+    return true;
+}
+
+inline bool scenario_value(XmlRpc::XmlRpcValue &v, double &value)
+{
+    if (v.getType() == XmlRpc::XmlRpcValue::TypeDouble)
+        value = (double)v;
+    else if (v.getType() == XmlRpc::XmlRpcValue::TypeInt)
+        value = (int)v;
+    else
+        return false;
+    return true;
+}
+
+inline bool scenario_value(XmlRpc::XmlRpcValue &v, int &value)
+{
+    if (v.getType() != XmlRpc::XmlRpcValue::TypeInt)
+        return false;
+    value = (int)v;
+    return true;
+}
+
+inline bool scenario_value(XmlRpc::XmlRpcValue &v, bool &value)
+{
+    if (v.getType() != XmlRpc::XmlRpcValue::TypeBoolean)
+        return false;
+    value = (bool)v;
+    return true;
+}
+
+inline bool scenario_value(XmlRpc::XmlRpcValue &v, std::string &value)
+{
+    if (v.getType() != XmlRpc::XmlRpcValue::TypeString)
+        return false;
+    value = (std::string)v;
+    return true;
+}
+
+// a number of a scenario, 0 if it is none.
+inline double scenario_double(XmlRpc::XmlRpcValue &v)
+{
+    double d = 0.;
+    scenario_value(v, d);
+    return d;
+}
+
+// replays a batch/jep_trajectory, a list of [t, q_1, ..., q_n]: true
+// and the jep in q if entry ind is due at time t (ind is then
+// advanced). traj may be NULL.
+inline bool next_trajectory_jep(XmlRpc::XmlRpcValue *traj, int &ind, double t, std::vector<double> &q)
+{
+    if (traj == NULL || ind >= traj->size() || scenario_double((*traj)[ind][0]) > t)
+        return false;
+
+    XmlRpc::XmlRpcValue &entry = (*traj)[ind];
+    q.resize(entry.size()-1);
+    for (int k = 1; k < entry.size(); k++)
+        q[k-1] = scenario_double(entry[k]);
+    ind++;
+    return true;
+}
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef SIM_SCHEDULER_H
+#define SIM_SCHEDULER_H
+
+#include "ros/ros.h"
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <string>
+#include <vector>
+#include <cmath>
+
+// Periodic tasks of the simulation loop (publishing, skin, torque
+// updates, ...) that run at a fraction of the physics rate. Periods
+// and phase offsets are given in seconds and rounded up to whole
+// physics steps. A task with period N and phase p runs on the steps
+// p, p+N, p+2N, ... (N, 2N, ... for p = 0), so tasks with the same
+// period but different phases land on different steps.
+class SimScheduler
+{
+    public:
+        SimScheduler() : timestep(1.) {}
+
+        void set_timestep(double dt) { timestep = dt; }
+
+        // returns the id of the task.
+        int add_task(const std::string &name, double period, double phase,
+                const boost::function<void ()> &f)
+        {
+            Task t;
+            t.name = name;
+            t.period = std::max(1, (int)ceil(period/timestep));
+            t.phase = (int)ceil(phase/timestep) % t.period;
+            t.countdown = t.phase > 0 ? t.phase : t.period;
+            t.f = f;
+            t.timed_elsewhere = false;
+            tasks.push_back(t);
+            reset_stats(tasks.size()-1);
+            return tasks.size()-1;
+        }
+
+        // one physics step has passed.
+        void tick()
+        {
+            for (unsigned int i = 0; i < tasks.size(); i++)
+                tasks[i].countdown--;
+        }
+
+        // runs the task if it is due on this step (or if force is
+        // set, which also restarts its period). Returns true if the
+        // task ran.
+        bool run(int id, bool force=false)
+        {
+            Task &t = tasks[id];
+            if (t.countdown > 0 && force == false)
+                return false;
+            t.countdown = t.period;
+
+            if (t.timed_elsewhere == true)
+            {
+                t.f();
+                return true;
+            }
+
+            double t_start = ros::WallTime::now().toSec();
+            t.f();
+            double dt = ros::WallTime::now().toSec() - t_start;
+
+            t.num_runs++;
+            t.t_total += dt;
+            if (dt > t.t_max)
+                t.t_max = dt;
+            return true;
+        }
+
+        // the task only hands its work to another thread, which times
+        // the work with record. Its run times are not taken.
+        void time_elsewhere(int id) { tasks[id].timed_elsewhere = true; }
+
+        // one execution of a task that is timed elsewhere (any thread).
+        void record(int id, double dt)
+        {
+            boost::mutex::scoped_lock lock(record_lock);
+            Task &t = tasks[id];
+            t.num_runs++;
+            t.t_total += dt;
+            if (dt > t.t_max)
+                t.t_max = dt;
+        }
+
+        // execution time of each task since the last report.
+        void report()
+        {
+            boost::mutex::scoped_lock lock(record_lock);
+            ROS_INFO("%-12s %8s %8s %8s %12s %12s \n", "task", "period", "phase", "runs", "mean [us]", "max [us]");
+            for (unsigned int i = 0; i < tasks.size(); i++)
+            {
+                Task &t = tasks[i];
+                ROS_INFO("%-12s %8d %8d %8ld %12.1f %12.1f \n", t.name.c_str(), t.period, t.phase,
+                        t.num_runs, t.num_runs > 0 ? t.t_total/t.num_runs*1e6 : 0., t.t_max*1e6);
+                reset_stats(i);
+            }
+        }
+
+    protected:
+        struct Task
+        {
+            std::string name;
+            int period; // [steps]
+            int phase; // [steps]
+            int countdown; // steps until the task is due
+            boost::function<void ()> f;
+            bool timed_elsewhere;
+
+            long num_runs;
+            double t_total; // [s]
+            double t_max; // [s]
+        };
+
+        void reset_stats(int id)
+        {
+            tasks[id].num_runs = 0;
+            tasks[id].t_total = 0.;
+            tasks[id].t_max = 0.;
+        }
+
+        std::vector<Task> tasks;
+        double timestep;
+        boost::mutex record_lock; // stats of the tasks timed elsewhere
+};
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef SIM_TAXELS_H
+#define SIM_TAXELS_H
+
+#include <ode/ode.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// rotates n points (or vectors) from the frame of a body to the world
+// frame,
+//   w = R*l + pos
+// without pos for vectors (pos = NULL). The sums are done in the same
+// order as dBodyGetRelPointPos/dBodyVectorToWorld, so the results are
+// the same. Two points per SSE2 instruction.
+inline void body_to_world(int n, const dReal *R, const dReal *pos,
+        const double *l_x, const double *l_y, const double *l_z,
+        double *w_x, double *w_y, double *w_z)
+{
+    int i = 0;
+#ifdef __SSE2__
+    for (; i+2 <= n; i += 2)
+    {
+        __m128d x = _mm_loadu_pd(l_x+i);
+        __m128d y = _mm_loadu_pd(l_y+i);
+        __m128d z = _mm_loadu_pd(l_z+i);
+        for (int r = 0; r < 3; r++)
+        {
+            __m128d w = _mm_add_pd(_mm_add_pd(_mm_mul_pd(_mm_set1_pd(R[4*r]), x),
+                        _mm_mul_pd(_mm_set1_pd(R[4*r+1]), y)),
+                    _mm_mul_pd(_mm_set1_pd(R[4*r+2]), z));
+            if (pos != NULL)
+                w = _mm_add_pd(w, _mm_set1_pd(pos[r]));
+            _mm_storeu_pd((r == 0 ? w_x : (r == 1 ? w_y : w_z))+i, w);
+        }
+    }
+#endif
+    for (; i < n; i++)
+    {
+        w_x[i] = R[0]*l_x[i] + R[1]*l_y[i] + R[2]*l_z[i];
+        w_y[i] = R[4]*l_x[i] + R[5]*l_y[i] + R[6]*l_z[i];
+        w_z[i] = R[8]*l_x[i] + R[9]*l_y[i] + R[10]*l_z[i];
+        if (pos != NULL)
+        {
+            w_x[i] += pos[0];
+            w_y[i] += pos[1];
+            w_z[i] += pos[2];
+        }
+    }
+}
+
+// orders taxels by their position along the link axis (z), ties by
+// index.
+struct TaxelAxisLess
+{
+    const std::vector<double> *z;
+    bool operator()(int a, int b) const
+    {
+        if ((*z)[a] != (*z)[b])
+            return (*z)[a] < (*z)[b];
+        return a < b;
+    }
+};
+
+// taxels of the simulated skin in the frame of their link. The
+// layout only depends on the link geometry and the resolution, so
+// it is built once with the robot. Taxels of link l are
+// [first[l], first[l+1]), in the order of the TaxelArray message.
+struct TaxelLayout
+{
+    std::vector<double> center_x;
+    std::vector<double> center_y;
+    std::vector<double> center_z;
+    std::vector<double> normal_x;
+    std::vector<double> normal_y;
+    std::vector<double> normal_z;
+    std::vector<std::string> link_names;
+    std::vector<int> first;
+    // per link, the taxels sorted along the link axis (same ranges
+    // as above) and their axis coordinate, to search the taxels
+    // close to a contact.
+    std::vector<int> axis_order;
+    std::vector<double> axis_z;
+
+    int size() const { return center_x.size(); }
+    int num_links() const { return (int)first.size()-1; }
+
+    void clear()
+    {
+        center_x.clear();
+        center_y.clear();
+        center_z.clear();
+        normal_x.clear();
+        normal_y.clear();
+        normal_z.clear();
+        link_names.clear();
+        first.assign(1, 0);
+        axis_order.clear();
+        axis_z.clear();
+    }
+
+    // the i-th normal added belongs to the i-th center. Centers and
+    // normals may be interleaved or added in two runs, end_link only
+    // checks that their counts match.
+    void add_center(const std::string &link, double x, double y, double z)
+    {
+        center_x.push_back(x);
+        center_y.push_back(y);
+        center_z.push_back(z);
+        link_names.push_back(link);
+    }
+
+    void add_normal(double x, double y, double z)
+    {
+        normal_x.push_back(x);
+        normal_y.push_back(y);
+        normal_z.push_back(z);
+    }
+
+    // returns false if the link has not as many normals as centers.
+    bool end_link()
+    {
+        int b = first.back();
+        first.push_back(size());
+
+        TaxelAxisLess less;
+        less.z = &center_z;
+        for (int i = b; i < size(); i++)
+            axis_order.push_back(i);
+        std::sort(axis_order.begin()+b, axis_order.end(), less);
+        for (int i = b; i < size(); i++)
+            axis_z.push_back(center_z[axis_order[i]]);
+
+        return normal_x.size() == center_x.size();
+    }
+};
+
+#endif
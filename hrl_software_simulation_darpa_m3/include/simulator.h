@@ -1,48 +1,139 @@
 #include "ros/ros.h"
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 #include "hrl_haptic_manipulation_in_clutter_msgs/SkinContact.h"
 #include "hrl_haptic_manipulation_in_clutter_msgs/BodyDraw.h"
 #include "hrl_haptic_manipulation_in_clutter_msgs/TaxelArray.h"
 #include "hrl_haptic_manipulation_in_clutter_msgs/MechanicalImpedanceParams.h"
+#include "hrl_haptic_manipulation_in_clutter_srvs/SimStep.h"
 #include "hrl_msgs/FloatArrayBare.h"
 #include "std_msgs/String.h"
 #include <tf/transform_broadcaster.h>  
 #include "rosgraph_msgs/Clock.h"
+#include "diagnostic_msgs/DiagnosticArray.h"
 #include <cmath>
 #include <vector>
 #include <string>
 #include <iostream>
 #include <set>
+#include <deque>
 #include <algorithm>
 #include <functional>
 #include <ode/ode.h>
 #include <sstream>
+#include <stdexcept>
+#include <boost/shared_ptr.hpp>
+#include <boost/bind.hpp>
+#include "sim_scenario.h"
+#include "sim_scheduler.h"
+#include "sim_obstacles.h"
+#include "sim_taxels.h"
+#include "sim_handoff.h"
+#include "sim_commands.h"
+#include "sim_publish.h"
+#include "sim_profiler.h"
 
 #ifdef dDOUBLE
 #define MAX_CONTACTS 20          // maximum number of contact points per body
-#define MAX_FEEDBACKNUM 100
-#define NUM_OBST 1000
+#define INITIAL_FEEDBACKNUM 1000 // initial size of the contact feedback pool, it grows if needed
 #define MAX_NUM_REV 30
 #define MAX_NUM_PRISM 30
 #define PI 3.14159265
+#define PROXIMITY_RANGE 0.35     // [m], farthest obstacle the proximity taxels see
+
+// collision categories, geoms of a category only collide with the
+// categories in its collide bits.
+#define ARM_CATEGORY 1
+#define MOVABLE_CATEGORY 2
+#define STATIC_CATEGORY 4
+#define RAY_CATEGORY 8           // proximity rays, only tested against the obstacles
 #endif
 
 struct MyFeedback {
     dJointFeedback fb;
 };
 
+// contacts between the arm and the obstacles in one step, written by
+// nearCallback (structure of arrays). A group is all contacts of one
+// link-obstacle pair. The arrays are reused every step and only grow
+// (see Simulator::reserve_arm_contacts), so nothing is allocated once
+// they have reached the largest number of contacts of a scene. Reset
+// by clear().
+struct ArmContacts {
+    int num_groups;
+    std::vector<int> link;
+    std::vector<double> loc_x; // mean contact location of a group
+    std::vector<double> loc_y;
+    std::vector<double> loc_z;
+    std::vector<int> first_pt;
+    std::vector<int> num_pts;
+
+    int num_pts_total;
+    std::vector<double> pt_x;
+    std::vector<double> pt_y;
+    std::vector<double> pt_z;
+
+    // group and sign of the force of each joint feedback. ODE only
+    // writes f2 if the obstacle has a body (not for fixed obstacles).
+    std::vector<int> force_grouping;
+    std::vector<int> force_sign;
+    std::vector<char> obst_has_body;
+};
+
+// work of the sensor stage
+#define SENSE_SKIN 1      // skin contacts and force taxels
+#define SENSE_PROXIMITY 2 // proximity taxels
+#define SENSE_VIZ 4       // BodyDraw and impedance params
+
+// what the sensor stage needs from one physics step. The physics
+// loop copies it and the sensor stage builds and publishes its
+// messages from the copy only (never from ODE), either right away
+// or on the sensor thread while the next steps are simulated.
+struct SensorSnapshot {
+    int tasks; // SENSE_*
+    double time;
+    std::vector<double> link_pose; // per link position (3) and rotation (12)
+    std::vector<double> obst_pose; // same, per movable and compliant obstacle
+    hrl_haptic_manipulation_in_clutter_msgs::SkinContact skin;
+    std::vector<int> contact_link; // link of each skin contact
+    std::vector<double> prox_ray_dist; // per taxel, ray mode only
+    std::vector<double> k_p; // impedance, viz only
+    std::vector<double> k_d;
+};
+
+// mean time [s] of the hot paths of a step, see
+// Simulator::benchmark_hot_paths.
+struct HotPathTimes {
+    double near_callback; // all nearCallback calls of a step
+    double sense_forces;
+    double taxel_config; // setup_current_taxel_config
+    double taxel_simulation; // update_taxel_simulation
+    double proximity_simulation; // update_proximity_simulation
+    double step; // full step and clear
+    int contacts; // contact joints of the timed state
+    int arm_contacts;
+};
+
 
 class Simulator{
     public:
         //  bool got_image;
         Simulator(ros::NodeHandle &nh);
+        // headless simulator that is set up from a scenario (see
+        // sim_scenario.h) and does not publish anything.
+        Simulator(const XmlRpc::XmlRpcValue &scenario_params);
         ~Simulator();
-        void JepCallback(const hrl_msgs::FloatArrayBare msg);
-        void ImpedanceCallback(const hrl_haptic_manipulation_in_clutter_msgs::MechanicalImpedanceParams msg);
-        void BaseEpCallback(const hrl_msgs::FloatArrayBare msg);
+        void JepCallback(const hrl_msgs::FloatArrayBare::ConstPtr &msg);
+        void ImpedanceCallback(const hrl_haptic_manipulation_in_clutter_msgs::MechanicalImpedanceParams::ConstPtr &msg);
+        // same as a jep message, for callers without ROS.
+        bool set_jep(const std::vector<double> &jep_cmd) { return commands.set_jep(jep_cmd); }
+        bool StepCallback(hrl_haptic_manipulation_in_clutter_srvs::SimStep::Request &req,
+                          hrl_haptic_manipulation_in_clutter_srvs::SimStep::Response &res);
+        void BaseEpCallback(const hrl_msgs::FloatArrayBare::ConstPtr &msg);
         void create_fixed_obstacles();
         void create_movable_obstacles();
         void create_compliant_obstacles();
+        void set_auto_disable(dBodyID body, XmlRpc::XmlRpcValue &params);
         void create_robot();
         void sense_forces();
         void go_initial_position();
@@ -51,33 +142,84 @@ class Simulator{
         static void nearCallback (void *data, dGeomID o1, dGeomID o2);
         void classCallback (dGeomID o1, dGeomID o2);
         void publish_angle_data();
-        void publish_imped_skin_viz();
-        void update_linkage_viz();
+        void report_task_times();
+        void update_linkage_viz(const SensorSnapshot &s);
+        void update_obstacle_viz(const SensorSnapshot &s);
+        void init_viz();
         void inner_torque_loop();
         void update_friction_and_obstacles();
         void get_joint_data();	
         void clear();
-        void update_taxel_simulation();
-        void update_proximity_simulation();
+        void update_taxel_simulation(const SensorSnapshot &s);
+        void update_proximity_simulation(const SensorSnapshot &s);
+        // builds and publishes the sensor messages on a thread of
+        // their own from now on (not in headless mode).
+        void start_sensor_thread();
+        // sends the messages on a thread of their own from now on,
+        // the physics and sensor stages only queue them.
+        void start_publish_thread();
+        void step(bool sense_skin=false);
+        void create_world();
+        double max_contact_force();
+        dSpaceID create_space(const std::string &type, dSpaceID parent);
+        void collide();
+        void collide(dNearCallback *callback, void *data);
+        void set_solver(const std::string &type, int iterations, double sor);
+        void world_step();
+        void benchmark_collision_spaces(int num_steps);
+        void benchmark_hot_paths(int num_reps, HotPathTimes &t);
+        static void countPairsCallback(void *data, dGeomID o1, dGeomID o2);
+        const std::vector<double> &get_joint_angles() const { return q; }
+        int num_arm_contacts() const { return fbnum; }
 	double get_dist(double x1, double y1, double x2, double y2, double radius);
-	void setup_current_taxel_config(hrl_haptic_manipulation_in_clutter_msgs::TaxelArray &taxel);
+	void setup_current_taxel_config(hrl_haptic_manipulation_in_clutter_msgs::TaxelArray &taxel, const double *link_pose);
+        void init_taxel_layout();
+        int nearest_taxel(int l, const geometry_msgs::Point &loc, const geometry_msgs::Vector3 &force, const double *link_pose);
+        bool taxel_within_angle(int k, const geometry_msgs::Vector3 &force);
+        void create_proximity_rays();
+        void update_proximity_rays();
+        static void rayCallback(void *data, dGeomID o1, dGeomID o2);
+        TaxelLayout taxel_layout;
         ros::Publisher clock_pub; 
-	dSimpleSpace space;
+	dSpaceID space;
+	// subspaces of space, only arm-everything and
+	// movable-(movable, static) pairs are ever tested.
+	dSpaceID arm_space;
+	dSpaceID movable_space; // movable and compliant obstacles
+	dSpaceID static_space; // fixed obstacles
+	// rays of the proximity sensor (ray mode), not part of space.
+	dSpaceID ray_space;
 	dWorld world;
 	static const dReal timestep=0.0005;
 	double cur_time;
 
     protected:
+        void init();
+        template <class T> bool get_param(const std::string &name, T &value);
+        template <class T> void wait_for_param(const std::string &name, T &value);
+
+        // broadphase configuration (collision_space params)
+        std::string space_type;
+        int hash_min_level;
+        int hash_max_level;
+        double quadtree_limits[4]; // xmin, xmax, ymin, ymax
+        int quadtree_depth;
+
+        // constraint solver (solver params), step is the dense LCP
+        // solver, quickstep the iterative one.
+        std::string solver_type;
+        int quickstep_iterations;
+        double quickstep_sor;
+
         dHingeJoint manip_rev_jts[MAX_NUM_REV];
         dHingeJoint base_rev_jts[MAX_NUM_REV];
         dSliderJoint manip_pris_jts[MAX_NUM_PRISM];
         dSliderJoint base_pris_jts[MAX_NUM_PRISM];
-        dBody obstacles[NUM_OBST];
-        dBody fixed_obstacles[NUM_OBST];
-        dBody compliant_obstacles[NUM_OBST];
-        double obst_home[NUM_OBST][3];
-        double obst_stiffness[NUM_OBST];
-        double obst_damping[NUM_OBST];
+        ObstacleStore obst;
+        ObstacleGrid obst_grid;
+        std::vector<int> prox_candidates;
+        std::vector<hrl_msgs::FloatArrayBare> fixed_obst_loc;
+        std::vector<hrl_msgs::FloatArrayBare> fixed_obst_rot;
 
         dBody links_arr[100];  // just make a really big number ????, or resize the array if necessary instead
         double links_dim[100][3];
@@ -85,10 +227,8 @@ class Simulator{
         dBox g_link_box[100];
         dCapsule g_link_cap[100];
         dBodyID link_ids[100];
-        dBodyID fixed_obst_ids[NUM_OBST];
-        dJointID plane2d_joint_ids[NUM_OBST];
-        dJointID compliant_plane2d_joint_ids[NUM_OBST];
-        dJointID fixed_joint_ids[NUM_OBST];
+        int link_index[100]; // geom data of the link geoms
+        std::vector<std::string> link_names; // link1, link2, ...
 
         dBody *body_mobile_base;
         dBox *geom_mobile_base;
@@ -99,34 +239,47 @@ class Simulator{
         hrl_msgs::FloatArrayBare jep_ros;
 
 	bool use_prox_sensor;
+	// center: distance to the obstacle centers, ray: rays cast
+	// over the field of view of each taxel.
+	std::string proximity_mode;
+	int rays_per_taxel;
+	std::vector<dGeomID> prox_rays; // rays_per_taxel per taxel
+	std::vector<int> prox_ray_taxel; // geom data of the rays
+	std::vector<double> prox_ray_cos; // direction of a ray w.r.t the taxel normal
+	std::vector<double> prox_ray_sin;
+	std::vector<double> prox_ray_dist; // per taxel, nearest hit
         int num_links;
         int num_jts;
 	double resolution;
-        ros::NodeHandle nh_;
-        MyFeedback feedbacks[MAX_FEEDBACKNUM];
-        MyFeedback frict_feedbacks[NUM_OBST];
+        ros::NodeHandle *nh_;
+        bool headless;
+        XmlRpc::XmlRpcValue scenario;
+        // joint feedbacks of the arm contacts. ODE keeps pointers to
+        // them during a step, a deque does not move its elements when
+        // it grows.
+        std::deque<MyFeedback> feedbacks;
+        void reserve_arm_contacts(int numc);
         int fbnum;
         int force_group;
         double max_friction;
         double max_tor_friction;
         std::vector<double> q;
         std::vector<double> q_dot;
+        // command the torques are computed with, taken from commands
+        // by calc_torques (physics thread only).
         std::vector<double> jep;
         std::vector<double> k_p;
         std::vector<double> k_d;
         std::vector<double> torques;
+        // commands from the callbacks and the lockstep service.
+        CommandBuffer commands;
 
         // std::vector<double> mobile_base_k_p(3, 0);
         // std::vector<double> mobile_base_k_d(3, 0);
         // std::vector<double> mobile_base_ep(3, 0); // x, y, theta
         // std::vector<double> mobile_base_generalized_forces(3, 0); // Fx, Fy, Tz
 
-        //  std::vector<std::string> names[MAX_FEEDBACKNUM];
-        std::vector<int> force_grouping;
-        std::vector<int> force_sign;
-        std::vector<double> pt_x;
-        std::vector<double> pt_y;
-        std::vector<double> pt_z;
+        ArmContacts arm_contacts;
 
         //Temporary variables that should be cleaned up with TF at some point///////
         std::vector<double> x_c;
@@ -140,7 +293,17 @@ class Simulator{
         dBody *env;
 
         hrl_haptic_manipulation_in_clutter_msgs::SkinContact skin;
+        // draw has the links and the obstacles that moved since they
+        // were last published, static_draw the fixed obstacles.
         hrl_haptic_manipulation_in_clutter_msgs::BodyDraw draw;
+        hrl_haptic_manipulation_in_clutter_msgs::BodyDraw static_draw;
+        // pose (3 position, 12 rotation) of each movable and compliant
+        // obstacle when it was last published.
+        std::vector<double> viz_sent_pose;
+        double viz_pos_tolerance; // [m]
+        double viz_rot_tolerance; // rotation matrix entries
+        double viz_keyframe_period; // [s], all obstacles are resent
+        double viz_next_keyframe;
         hrl_haptic_manipulation_in_clutter_msgs::TaxelArray force_taxel;
         hrl_haptic_manipulation_in_clutter_msgs::TaxelArray proximity_taxel;
         hrl_haptic_manipulation_in_clutter_msgs::MechanicalImpedanceParams impedance_params;
@@ -152,6 +315,7 @@ class Simulator{
         ros::Publisher angles_pub;
         ros::Publisher angle_rates_pub;
         ros::Publisher bodies_draw;
+        ros::Publisher static_bodies_draw;
         ros::Publisher force_taxel_pub;
         ros::Publisher proximity_taxel_pub;
         ros::Publisher imped_pub;
@@ -162,47 +326,241 @@ class Simulator{
 	int num_used_fixed;
 	int num_used_compliant;
 
-	boost::mutex m;
-
+        // periodic tasks within step().
+        SimScheduler scheduler;
+        int clock_task;
+        int joints_task;
+        int skin_task;
+        int proximity_task;
+        int viz_task;
+        int torque_task;
+        void add_task(int &id, const std::string &name, double period, const boost::function<void ()> &f);
+        void publish_clock();
+        void publish_joint_data();
+        void update_skin(SensorSnapshot &s);
+        void update_proximity(SensorSnapshot &s);
+        void update_viz(SensorSnapshot &s);
+
+        // time spent in the phases of step(), contacts and constraint
+        // rows, published on /diagnostics once per diag_period of
+        // wall time.
+        SimProfiler profiler;
+        int collide_phase;
+        int solver_phase;
+        int forces_phase;
+        int obstacles_phase;
+        int sensors_phase;
+        int step_phase;
+        int num_contacts; // contact joints of this step
+        int count_obstacle_rows();
+        void publish_diagnostics(double wall_time);
+        ros::Publisher diag_pub;
+        diagnostic_msgs::DiagnosticArray diagnostics;
+        double diag_period;
+        bool diag_started; // the first window starts with the first step
+        double diag_wall_last;
+        double diag_sim_last;
+
+        // sensor stage, see SensorSnapshot. The messages it builds
+        // (force_taxel, proximity_taxel, draw, ...) and its state
+        // (obst_grid, viz_sent_pose, ...) belong to the sensor
+        // thread while it runs.
+        int sensor_request; // SENSE_* due on this step
+        void request_sensors(int tasks) { sensor_request |= tasks; }
+        void dispatch_sensors();
+        void capture_sensor_snapshot(SensorSnapshot &s, int tasks);
+        void process_sensor_snapshot(SensorSnapshot &s);
+        void sensor_worker();
+        SensorSnapshot sensor_snapshot; // without the sensor thread
+        SnapshotHandoff<SensorSnapshot> sensor_handoff;
+        boost::thread sensor_thread;
+        bool sensor_thread_running;
+        // taxels the proximity rays start from (physics thread).
+        hrl_haptic_manipulation_in_clutter_msgs::TaxelArray ray_taxel;
+        boost::shared_ptr<tf::TransformBroadcaster> br;
+
+        // outgoing messages, one queue per message type and producing
+        // thread (physics: clock, joints, tf; sensor stage: the rest).
+        PublishQueue<rosgraph_msgs::Clock> clock_queue;
+        PublishQueue<hrl_msgs::FloatArrayBare> joint_queue;
+        PublishQueue<tf::StampedTransform, tf::TransformBroadcaster> tf_queue;
+        PublishQueue<hrl_haptic_manipulation_in_clutter_msgs::SkinContact> skin_queue;
+        PublishQueue<hrl_haptic_manipulation_in_clutter_msgs::TaxelArray> taxel_queue;
+        PublishQueue<hrl_haptic_manipulation_in_clutter_msgs::BodyDraw> draw_queue;
+        PublishQueue<hrl_haptic_manipulation_in_clutter_msgs::MechanicalImpedanceParams> imped_queue;
+        PublishQueue<diagnostic_msgs::DiagnosticArray> diag_queue;
+        PublishThread publish_thread;
 };
 
 Simulator::Simulator(ros::NodeHandle &nh) :
-    nh_(nh)
+    nh_(&nh),
+    headless(false)
 {
-    num_used_movable = NUM_OBST;
-    num_used_fixed = NUM_OBST;
-    num_used_compliant = NUM_OBST;
+    init();
+}
+
+Simulator::Simulator(const XmlRpc::XmlRpcValue &scenario_params) :
+    nh_(NULL),
+    headless(true),
+    scenario(scenario_params)
+{
+    init();
+}
+
+void Simulator::init()
+{
+    num_used_movable = 0;
+    num_used_fixed = 0;
+    num_used_compliant = 0;
 
     //timestep = 0.0005;
     cur_time = 0.0;
 
+    // rates of the periodic tasks, each can be changed with
+    // /m3/software_testbed/scheduler/<name>: [period, phase] [s].
+    // Tasks with the same period and different phases are spread
+    // over different physics steps.
+    scheduler.set_timestep(timestep);
+    add_task(clock_task, "clock", 0.002, boost::bind(&Simulator::publish_clock, this));
+    add_task(joints_task, "joints", 0.01, boost::bind(&Simulator::publish_joint_data, this));
+    add_task(skin_task, "skin", 0.01, boost::bind(&Simulator::request_sensors, this, SENSE_SKIN));
+    add_task(proximity_task, "proximity", 0.01, boost::bind(&Simulator::request_sensors, this, SENSE_PROXIMITY));
+    add_task(viz_task, "viz", 0.01, boost::bind(&Simulator::request_sensors, this, SENSE_VIZ));
+    // their work is timed where it is done, in process_sensor_snapshot.
+    scheduler.time_elsewhere(skin_task);
+    scheduler.time_elsewhere(proximity_task);
+    scheduler.time_elsewhere(viz_task);
+    sensor_request = 0;
+    sensor_thread_running = false;
+    add_task(torque_task, "torque", 0.001, boost::bind(&Simulator::calc_torques, this));
+
+    collide_phase = profiler.add_phase("collide");
+    solver_phase = profiler.add_phase("world_step");
+    forces_phase = profiler.add_phase("sense_forces");
+    obstacles_phase = profiler.add_phase("friction_and_obstacles");
+    sensors_phase = profiler.add_phase("sensors");
+    step_phase = profiler.add_phase("step");
+    num_contacts = 0;
+    diag_period = 1.0;
+    get_param("/m3/software_testbed/diagnostics_period", diag_period);
+    diag_started = false;
+    diag_wall_last = 0.;
+    diag_sim_last = 0.;
+
     resolution = 0;
     use_prox_sensor = false;
     num_links = 0;
     num_jts = 0;
-    while (nh_.getParam("/m3/software_testbed/linkage/num_links", num_links) == false)
-        sleep(0.1);
-    while (nh_.getParam("/m3/software_testbed/joints/num_joints", num_jts) == false)
-        sleep(0.1);
-    while (nh_.getParam("/use_prox_sensor", use_prox_sensor) == false)
-        sleep(0.1);
-    while (nh_.getParam("/m3/software_testbed/resolution", resolution) == false)
-        sleep(0.1);
+    wait_for_param("/m3/software_testbed/linkage/num_links", num_links);
+    wait_for_param("/m3/software_testbed/joints/num_joints", num_jts);
+    wait_for_param("/use_prox_sensor", use_prox_sensor);
+    wait_for_param("/m3/software_testbed/resolution", resolution);
+
+    proximity_mode = "center";
+    rays_per_taxel = 5;
+    get_param("/m3/software_testbed/proximity/mode", proximity_mode);
+    get_param("/m3/software_testbed/proximity/rays_per_taxel", rays_per_taxel);
+    if (proximity_mode != "center" && proximity_mode != "ray")
+    {
+        std::cerr<<"wrong proximity mode was defined in config file,"<<proximity_mode<<" does not exist \n";
+        assert(false);
+    }
+    if (rays_per_taxel < 1)
+        rays_per_taxel = 1;
+
+    // broadphase used for the collision detection. simple tests all
+    // pairs, hash and quadtree should be sized to the obstacles
+    // (hash_levels) and workspace (quadtree_limits), sap is sweep
+    // and prune.
+    space_type = "simple";
+    hash_min_level = -5;
+    hash_max_level = 1;
+    quadtree_limits[0] = -0.2;
+    quadtree_limits[1] = 1.0;
+    quadtree_limits[2] = -0.8;
+    quadtree_limits[3] = 0.8;
+    quadtree_depth = 5;
+
+    get_param("/m3/software_testbed/collision_space/type", space_type);
+    XmlRpc::XmlRpcValue space_param;
+    if (get_param("/m3/software_testbed/collision_space/hash_levels", space_param) == true)
+    {
+        hash_min_level = (int)space_param[0];
+        hash_max_level = (int)space_param[1];
+    }
+    if (get_param("/m3/software_testbed/collision_space/quadtree_limits", space_param) == true)
+    {
+        for (int i = 0; i < 4; i++)
+            quadtree_limits[i] = (double)space_param[i];
+    }
+    get_param("/m3/software_testbed/collision_space/quadtree_depth", quadtree_depth);
+
+    std::string solver = "step";
+    int iterations = 20;
+    double sor = 1.3;
+    get_param("/m3/software_testbed/solver/type", solver);
+    get_param("/m3/software_testbed/solver/iterations", iterations);
+    get_param("/m3/software_testbed/solver/sor", sor);
+    set_solver(solver, iterations, sor);
+
+    // an obstacle is only republished once it moved more than this.
+    // Every keyframe_period all of them are sent, for late
+    // subscribers.
+    viz_pos_tolerance = 0.0005;
+    viz_rot_tolerance = 0.001;
+    viz_keyframe_period = 1.0;
+    get_param("/m3/software_testbed/viz/position_tolerance", viz_pos_tolerance);
+    get_param("/m3/software_testbed/viz/rotation_tolerance", viz_rot_tolerance);
+    get_param("/m3/software_testbed/viz/keyframe_period", viz_keyframe_period);
+    viz_next_keyframe = 0.;
+
+    space = create_space(space_type, 0);
+    arm_space = create_space(space_type, space);
+    movable_space = create_space(space_type, space);
+    static_space = create_space(space_type, space);
+    ray_space = 0;
+
     fbnum=0;
     force_group=0;
+    arm_contacts.num_groups = 0;
+    arm_contacts.num_pts_total = 0;
+    feedbacks.resize(INITIAL_FEEDBACKNUM);
+    reserve_arm_contacts(INITIAL_FEEDBACKNUM);
     max_friction = 2;
     max_tor_friction = 0.5;
-    angles_pub = nh_.advertise<hrl_msgs::FloatArrayBare>("/sim_arm/joint_angles", 100);
-    angle_rates_pub = nh_.advertise<hrl_msgs::FloatArrayBare>("/sim_arm/joint_angle_rates", 100);  
-    bodies_draw = nh_.advertise<hrl_haptic_manipulation_in_clutter_msgs::BodyDraw>("/sim_arm/bodies_visualization", 100);
-    force_taxel_pub = nh_.advertise<hrl_haptic_manipulation_in_clutter_msgs::TaxelArray>("/skin/taxel_array", 100);
-    proximity_taxel_pub = nh_.advertise<hrl_haptic_manipulation_in_clutter_msgs::TaxelArray>("/haptic_mpc/simulation/proximity/taxel_array", 100);
-    imped_pub = nh_.advertise<hrl_haptic_manipulation_in_clutter_msgs::MechanicalImpedanceParams>("sim_arm/joint_impedance", 100);
-    skin_pub = nh_.advertise<hrl_haptic_manipulation_in_clutter_msgs::SkinContact>("/skin/contacts", 100);
-    jep_pub = nh_.advertise<hrl_msgs::FloatArrayBare>("/sim_arm/jep", 100);
-    clock_pub = nh_.advertise<rosgraph_msgs::Clock>("/clock", 1/timestep);
-
-    m.lock();
+    if (headless == false)
+    {
+        angles_pub = nh_->advertise<hrl_msgs::FloatArrayBare>("/sim_arm/joint_angles", 100);
+        angle_rates_pub = nh_->advertise<hrl_msgs::FloatArrayBare>("/sim_arm/joint_angle_rates", 100);  
+        bodies_draw = nh_->advertise<hrl_haptic_manipulation_in_clutter_msgs::BodyDraw>("/sim_arm/bodies_visualization", 100);
+        static_bodies_draw = nh_->advertise<hrl_haptic_manipulation_in_clutter_msgs::BodyDraw>("/sim_arm/static_bodies_visualization", 1, true);
+        force_taxel_pub = nh_->advertise<hrl_haptic_manipulation_in_clutter_msgs::TaxelArray>("/skin/taxel_array", 100);
+        proximity_taxel_pub = nh_->advertise<hrl_haptic_manipulation_in_clutter_msgs::TaxelArray>("/haptic_mpc/simulation/proximity/taxel_array", 100);
+        imped_pub = nh_->advertise<hrl_haptic_manipulation_in_clutter_msgs::MechanicalImpedanceParams>("sim_arm/joint_impedance", 100);
+        skin_pub = nh_->advertise<hrl_haptic_manipulation_in_clutter_msgs::SkinContact>("/skin/contacts", 100);
+        jep_pub = nh_->advertise<hrl_msgs::FloatArrayBare>("/sim_arm/jep", 100);
+        clock_pub = nh_->advertise<rosgraph_msgs::Clock>("/clock", 1/timestep);
+        diag_pub = nh_->advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 10);
+        br.reset(new tf::TransformBroadcaster());
+
+        clock_queue.name = "clock";
+        joint_queue.name = "joints";
+        tf_queue.name = "tf";
+        skin_queue.name = "skin";
+        taxel_queue.name = "taxels";
+        draw_queue.name = "viz";
+        imped_queue.name = "impedance";
+        diag_queue.name = "diagnostics";
+        publish_thread.add(clock_queue);
+        publish_thread.add(joint_queue);
+        publish_thread.add(tf_queue);
+        publish_thread.add(skin_queue);
+        publish_thread.add(taxel_queue);
+        publish_thread.add(draw_queue);
+        publish_thread.add(imped_queue);
+        publish_thread.add(diag_queue);
+    }
+
     for (int ii = 0; ii < num_jts; ii++)
     {
         q.push_back(0);
@@ -212,76 +570,193 @@ Simulator::Simulator(ros::NodeHandle &nh) :
         k_d.push_back(0);
         torques.push_back(0);
     }
-    m.unlock();
+    commands.init(num_jts);
 }
 
 Simulator::~Simulator()
 {
+    if (sensor_thread_running == true)
+    {
+        sensor_handoff.stop();
+        sensor_thread.join();
+    }
+    publish_thread.stop();
+
+    // link geoms are members and destroy themselves, the space
+    // destroys the subspaces and the obstacle geoms.
+    for (int ii = 0; ii < num_links; ii++)
+    {
+        if (links_shape[ii] == "cube")
+            dSpaceRemove(arm_space, g_link_box[ii].id());
+        else if (links_shape[ii] == "capsule")
+            dSpaceRemove(arm_space, g_link_cap[ii].id());
+    }
+    dSpaceDestroy(space);
+    if (ray_space != 0)
+        dSpaceDestroy(ray_space);
+}
+
+dSpaceID Simulator::create_space(const std::string &type, dSpaceID parent)
+{
+    if (type == "simple")
+        return dSimpleSpaceCreate(parent);
+    else if (type == "hash")
+    {
+        dSpaceID s = dHashSpaceCreate(parent);
+        dHashSpaceSetLevels(s, hash_min_level, hash_max_level);
+        return s;
+    }
+    else if (type == "quadtree")
+    {
+        dVector3 center = {(quadtree_limits[0]+quadtree_limits[1])/2.0,
+            (quadtree_limits[2]+quadtree_limits[3])/2.0, 0, 0};
+        dVector3 extents = {quadtree_limits[1]-quadtree_limits[0],
+            quadtree_limits[3]-quadtree_limits[2], 1.0, 0};
+        return dQuadTreeSpaceCreate(parent, center, extents, quadtree_depth);
+    }
+    else if (type == "sap")
+        return dSweepAndPruneSpaceCreate(parent, dSAP_AXES_XYZ);
+
+    std::cerr<<"wrong type of collision space was defined in config file,"<<type<<" does not exist \n";
+    assert(false);
+    return 0;
+}
+
+// reads a parameter from the param server, or from the scenario for
+// a headless simulator.
+template <class T>
+bool Simulator::get_param(const std::string &name, T &value)
+{
+    if (headless == false)
+        return nh_->getParam(name, value);
+
+    XmlRpc::XmlRpcValue *v = find_scenario_param(scenario, name);
+    if (v == NULL)
+        return false;
+    return scenario_value(*v, value);
+}
+
+// blocks until a parameter is on the param server. A scenario can not
+// change, so a missing parameter is an error there, thrown so that a
+// batch only loses the trial of that scenario.
+template <class T>
+void Simulator::wait_for_param(const std::string &name, T &value)
+{
+    while (get_param(name, value) == false)
+    {
+        if (headless == true)
+            throw std::runtime_error("scenario does not have the parameter " + name);
+        sleep(0.1);
+    }
 }
 
 using namespace std;
 
 
-void Simulator::JepCallback(const hrl_msgs::FloatArrayBare msg)
+// the commands only reach the torque loop through commands, which
+// never blocks it.
+void Simulator::JepCallback(const hrl_msgs::FloatArrayBare::ConstPtr &msg)
 {
-    m.lock();
-    jep = msg.data;
-    m.unlock();
+    if (commands.set_jep(msg->data) == false)
+        ROS_ERROR("jep command does not match the number of joints (%d)\n", num_jts);
 }
 
-void Simulator::ImpedanceCallback(const hrl_haptic_manipulation_in_clutter_msgs::MechanicalImpedanceParams msg)
+void Simulator::ImpedanceCallback(const hrl_haptic_manipulation_in_clutter_msgs::MechanicalImpedanceParams::ConstPtr &msg)
 {
-    m.lock();
-    k_p = msg.k_p.data;
-    k_d = msg.k_d.data;
-    m.unlock();
+    if (commands.set_impedance(msg->k_p.data, msg->k_d.data) == false)
+        ROS_ERROR("impedance command does not match the number of joints (%d)\n", num_jts);
+}
+
+// lockstep interface. Commands from the request are applied before
+// the first step and the skin is simulated on the last step so that
+// the response contains the state at the end of the request.
+bool Simulator::StepCallback(hrl_haptic_manipulation_in_clutter_srvs::SimStep::Request &req,
+                             hrl_haptic_manipulation_in_clutter_srvs::SimStep::Response &res)
+{
+    if ((!req.jep.empty() && (int)req.jep.size() != num_jts) ||
+        (!req.k_p.empty() && (int)req.k_p.size() != num_jts) ||
+        (!req.k_d.empty() && (int)req.k_d.size() != num_jts))
+    {
+        ROS_ERROR("SimStep command does not match the number of joints (%d)\n", num_jts);
+        return false;
+    }
+
+    if (!req.jep.empty())
+        commands.set_jep(req.jep);
+    if (!req.k_p.empty() || !req.k_d.empty())
+        commands.set_impedance(req.k_p, req.k_d);
+    calc_torques();
+
+    for (int i = 0; i < req.num_steps; i++)
+    {
+        bool last = (i == req.num_steps-1);
+        step(last);
+        if (last)
+        {
+            // lockstep has no sensor thread, the skin was just
+            // processed inline.
+            res.skin = sensor_snapshot.skin;
+            res.taxel_array = force_taxel;
+        }
+        clear();
+    }
+
+    res.sim_time = cur_time;
+    res.joint_angles = q;
+    res.joint_angle_rates = q_dot;
+    return true;
 }
 
 void Simulator::nearCallback(void *data, dGeomID o1, dGeomID o2)
 {
     Simulator* obj = (Simulator*) data;
     int i;
+
+    // one of the geoms is a space (e.g. static_space), test the other
+    // geom against everything in it.
+    if (dGeomIsSpace(o1) || dGeomIsSpace(o2))
+    {
+        dSpaceCollide2(o1, o2, data, &nearCallback);
+        return;
+    }
+
     dBodyID b1 = dGeomGetBody(o1);
     dBodyID b2 = dGeomGetBody(o2);
 
     if (b1 && b2 && dAreConnectedExcluding (b1,b2,dJointTypeContact)) return;
 
-    bool b1_is_link = false;
-    bool b2_is_link = false;
-
-    for (int i=0; i<obj->num_links; i++)
-    {
-        if (obj->link_ids[i] == b1)
-            b1_is_link = true;
-        if (obj->link_ids[i] == b2)
-            b2_is_link = true;
-    }
-
-    // ignoring link-link contact.
-    if (b1_is_link && b2_is_link)
+    // resting (disabled) obstacles do not collide with each other or
+    // with the fixed obstacles. The links are never disabled.
+    if ((b1 == 0 || !dBodyIsEnabled(b1)) && (b2 == 0 || !dBodyIsEnabled(b2)))
         return;
 
-    bool arm_contact = false;
-    stringstream ss;
-    bool is_b1 = false;
-
-    for (int i=0; i<obj->num_links; i++)
-    {
-        if (obj->link_ids[i] == b1 || obj->link_ids[i] == b2)
-        {
-            arm_contact = true;
-            ss <<"link"<<i+1;
-            if (obj->link_ids[i] == b1)
-                is_b1 = true;
-            else
-                is_b1 = false;
-        }
-    }
+    // link-link pairs never get here, the links are all in arm_space
+    // which is not collided with itself. Only link geoms have data.
+    int *link1 = (int*) dGeomGetData(o1);
+    int *link2 = (int*) dGeomGetData(o2);
+    bool arm_contact = (link1 != NULL || link2 != NULL);
+    bool is_b1 = (link1 != NULL);
 
     dContact contact[MAX_CONTACTS];   // up to MAX_CONTACTS contacts per box-box
     int numc = dCollide (o1, o2, MAX_CONTACTS, &(contact[0].geom), sizeof(dContact));
     if (numc > 0)
     {
+        // wake up an obstacle that is touched by the arm or by another
+        // moving obstacle.
+        if (b1 && !dBodyIsEnabled(b1))
+            dBodyEnable(b1);
+        if (b2 && !dBodyIsEnabled(b2))
+            dBodyEnable(b2);
+
+        // the friction of a touched obstacle has to be updated (only
+        // obstacle bodies have data).
+        int *obst1 = b1 ? (int*) dBodyGetData(b1) : NULL;
+        int *obst2 = b2 ? (int*) dBodyGetData(b2) : NULL;
+        if (obst1 != NULL)
+            obj->obst.dirty[*obst1] = 1;
+        if (obst2 != NULL)
+            obj->obst.dirty[*obst2] = 1;
+
         if (arm_contact == false)
         {// here contact is between two objects.
             for (int i=0; i<numc; i++)
@@ -297,11 +772,14 @@ void Simulator::nearCallback(void *data, dGeomID o1, dGeomID o2)
                 dJointAttach (c, dGeomGetBody(contact[i].geom.g1),
                         dGeomGetBody(contact[i].geom.g2));
             }
+            obj->num_contacts += numc;
         }
         else
         { // here contact is between a link of the arm and an object.
+            obj->reserve_arm_contacts(numc);
+            ArmContacts &ac = obj->arm_contacts;
+            int g = ac.num_groups;
             dVector3 contact_loc = {0, 0, 0};
-            obj->skin.link_names.push_back(ss.str());
 
             for (i=0; i<numc; i++) 
             {
@@ -316,74 +794,87 @@ void Simulator::nearCallback(void *data, dGeomID o1, dGeomID o2)
                 contact_loc[1] = contact_loc[1]+contact[i].geom.pos[1];
                 contact_loc[2] = contact_loc[2]+contact[i].geom.pos[2];
 
-                obj->pt_x.push_back(contact[i].geom.pos[0]);
-                obj->pt_y.push_back(contact[i].geom.pos[1]);
-                obj->pt_z.push_back(contact[i].geom.pos[2]);
-
                 dJointID c = dJointCreateContact (obj->world,obj->joints.id(),&contact[i]);
                 dJointAttach (c,b1,b2);
 
-                if (obj->fbnum < MAX_FEEDBACKNUM)
-                {
-                    dJointSetFeedback (c, &obj->feedbacks[obj->fbnum++].fb);
-                    obj->force_grouping.push_back(obj->force_group);
-                    if (is_b1 == true)
-                        obj->force_sign.push_back(1);
-                    else
-                        obj->force_sign.push_back(-1);
-                }
+                ac.pt_x[ac.num_pts_total+i] = contact[i].geom.pos[0];
+                ac.pt_y[ac.num_pts_total+i] = contact[i].geom.pos[1];
+                ac.pt_z[ac.num_pts_total+i] = contact[i].geom.pos[2];
+
+                ac.force_grouping[obj->fbnum] = obj->force_group;
+                ac.force_sign[obj->fbnum] = is_b1 ? 1 : -1;
+                ac.obst_has_body[obj->fbnum] = (is_b1 ? b2 : b1) != 0;
+                dJointSetFeedback (c, &obj->feedbacks[obj->fbnum++].fb);
             }
 
-            contact_loc[0] = contact_loc[0]/numc;
-            contact_loc[1] = contact_loc[1]/numc;
-            contact_loc[2] = contact_loc[2]/numc;
-            geometry_msgs::Point con_pt;
-            con_pt.x = contact_loc[0];
-            con_pt.y = contact_loc[1];
-            con_pt.z = contact_loc[2];
-
-            obj->skin.locations.push_back(con_pt);
-            hrl_msgs::FloatArrayBare pts_x_ar;
-            pts_x_ar.data = obj->pt_x;
-            obj->skin.pts_x.push_back(pts_x_ar);
-            hrl_msgs::FloatArrayBare pts_y_ar;
-            pts_y_ar.data = obj->pt_y;
-            obj->skin.pts_y.push_back(pts_y_ar);
-            hrl_msgs::FloatArrayBare pts_z_ar;
-            pts_z_ar.data = obj->pt_z;
-            obj->skin.pts_z.push_back(pts_z_ar);
-            obj->pt_x.clear();
-            obj->pt_y.clear();
-            obj->pt_z.clear();
+            ac.link[g] = is_b1 ? *link1 : *link2;
+            ac.loc_x[g] = contact_loc[0]/numc;
+            ac.loc_y[g] = contact_loc[1]/numc;
+            ac.loc_z[g] = contact_loc[2]/numc;
+            ac.first_pt[g] = ac.num_pts_total;
+            ac.num_pts[g] = numc;
+            ac.num_pts_total += numc;
+            ac.num_groups++;
             obj->force_group += 1;
+            obj->num_contacts += numc;
         }
     }
 }
 
+void Simulator::reserve_arm_contacts(int numc)
+{
+    ArmContacts &ac = arm_contacts;
+    if (ac.num_groups + 1 > (int)ac.link.size())
+    {
+        int n = std::max(2*(int)ac.link.size(), INITIAL_FEEDBACKNUM/MAX_CONTACTS);
+        ac.link.resize(n);
+        ac.loc_x.resize(n);
+        ac.loc_y.resize(n);
+        ac.loc_z.resize(n);
+        ac.first_pt.resize(n);
+        ac.num_pts.resize(n);
+    }
+    if (ac.num_pts_total + numc > (int)ac.pt_x.size())
+    {
+        int n = std::max(2*(int)ac.pt_x.size(), ac.num_pts_total + numc);
+        ac.pt_x.resize(n);
+        ac.pt_y.resize(n);
+        ac.pt_z.resize(n);
+    }
+    if (fbnum + numc > (int)ac.force_grouping.size())
+    {
+        int n = std::max(2*(int)ac.force_grouping.size(), fbnum + numc);
+        ac.force_grouping.resize(n);
+        ac.force_sign.resize(n);
+        ac.obst_has_body.resize(n);
+    }
+    if (fbnum + numc > (int)feedbacks.size())
+        feedbacks.resize(std::max(2*(int)feedbacks.size(), fbnum + numc));
+}
+
 void Simulator::publish_angle_data()
 {
-    angle_rates_pub.publish(angle_rates);
-    angles_pub.publish(angles);
-    jep_pub.publish(jep_ros);
+    joint_queue.publish(angle_rates_pub, angle_rates);
+    joint_queue.publish(angles_pub, angles);
+    joint_queue.publish(jep_pub, jep_ros);
 }
 
 void Simulator::go_initial_position()
 {
     XmlRpc::XmlRpcValue init_angle;
-    while (nh_.getParam("/m3/software_testbed/joints/init_angle", init_angle) == false)
-        sleep(0.1);
+    wait_for_param("/m3/software_testbed/joints/init_angle", init_angle);
 
     // // moving mobile base to 0, 0, 0
     // mobile_base_ep[0] = 0;
     // mobile_base_ep[1] = 0;
     // mobile_base_ep[2] = 0;
 
-    m.lock();
+    std::vector<double> init_jep(num_jts);
     for (int ii = 0; ii < num_jts ; ii++)
     {
-        jep[ii] = (double)init_angle[ii];
+        init_jep[ii] = (double)init_angle[ii];
     }
-    m.unlock();
+    commands.set_jep(init_jep);
 
     float error = 1.;
     float error_thresh = 0.005;
@@ -432,70 +923,95 @@ void Simulator::sense_forces()
 {
     geometry_msgs::Vector3 force;	
     geometry_msgs::Vector3 normal;	
-    if (fbnum>MAX_FEEDBACKNUM)
+
+    // contact locations and points that nearCallback recorded.
+    const ArmContacts &ac = arm_contacts;
+    skin.link_names.resize(ac.num_groups);
+    skin.locations.resize(ac.num_groups);
+    skin.pts_x.resize(ac.num_groups);
+    skin.pts_y.resize(ac.num_groups);
+    skin.pts_z.resize(ac.num_groups);
+    for (int g = 0; g < ac.num_groups; g++)
     {
-        printf("joint feedback buffer overflow!\n");
-        assert(false);
+        skin.link_names[g] = link_names[ac.link[g]];
+        skin.locations[g].x = ac.loc_x[g];
+        skin.locations[g].y = ac.loc_y[g];
+        skin.locations[g].z = ac.loc_z[g];
+        const double *pt_x = &ac.pt_x[ac.first_pt[g]];
+        const double *pt_y = &ac.pt_y[ac.first_pt[g]];
+        const double *pt_z = &ac.pt_z[ac.first_pt[g]];
+        skin.pts_x[g].data.assign(pt_x, pt_x + ac.num_pts[g]);
+        skin.pts_y[g].data.assign(pt_y, pt_y + ac.num_pts[g]);
+        skin.pts_z[g].data.assign(pt_z, pt_z + ac.num_pts[g]);
     }
-    else
+
+    dVector3 sum = {0, 0, 0};
+    for (int i=0; i<fbnum; i++) 
     {
-        dVector3 sum = {0, 0, 0};
-        for (int i=0; i<fbnum; i++) 
+        // the force on the obstacle. Without an obstacle body the
+        // link is body 1 (ODE swaps the bodies) and only f1 is written.
+        dReal *f = feedbacks[i].fb.f2;
+        int sign = ac.force_sign[i];
+        if (ac.obst_has_body[i] == false)
         {
-            dReal *f = feedbacks[i].fb.f2;
-            //printf("force 1 %f %f %f\n", feedbacks[i].fb.f1[0], feedbacks[i].fb.f1[1], feedbacks[i].fb.f1[2]);
-            //printf("force 2 %f %f %f\n", feedbacks[i].fb.f2[0], feedbacks[i].fb.f2[1], feedbacks[i].fb.f2[2]);
-            sum[0] += f[0] * force_sign[i];
-            sum[1] += f[1] * force_sign[i];
-            sum[2] += f[2] * force_sign[i];
-            if (i < fbnum-1)
-            {
-                if (force_grouping[i] != force_grouping[i+1])
-                {
-                    force.x = sum[0];
-                    force.y = sum[1];
-                    force.z = sum[2];
-                    skin.forces.push_back(force);
-
-                    // hacky code by Advait to add (fake) normals to the
-                    // SkinContact message. The normal is not the
-                    // vector normal to the surface of the arm.
-                    double f_mag = sqrt(sum[0]*sum[0]+sum[1]*sum[1]+sum[2]*sum[2]);
-                    normal.x = force.x / f_mag;
-                    normal.y = force.y / f_mag;
-                    normal.z = force.z / f_mag;
-                    skin.normals.push_back(normal);
-                    sum[0] = 0;
-                    sum[1] = 0;
-                    sum[2] = 0;
-                }
-                else
-                {
-                    ROS_WARN("Advait believes that this should never happen\n");
-                    exit(0);
-                }
-            }			
-            else
+            f = feedbacks[i].fb.f1;
+            sign = -1;
+        }
+        //printf("force 1 %f %f %f\n", feedbacks[i].fb.f1[0], feedbacks[i].fb.f1[1], feedbacks[i].fb.f1[2]);
+        //printf("force 2 %f %f %f\n", feedbacks[i].fb.f2[0], feedbacks[i].fb.f2[1], feedbacks[i].fb.f2[2]);
+        sum[0] += f[0] * sign;
+        sum[1] += f[1] * sign;
+        sum[2] += f[2] * sign;
+        if (i < fbnum-1)
+        {
+            if (ac.force_grouping[i] != ac.force_grouping[i+1])
             {
                 force.x = sum[0];
                 force.y = sum[1];
                 force.z = sum[2];
                 skin.forces.push_back(force);
 
-                // hacky code by Advait to add normals to the
-                // SkinContact message
+                // hacky code by Advait to add (fake) normals to the
+                // SkinContact message. The normal is not the
+                // vector normal to the surface of the arm.
                 double f_mag = sqrt(sum[0]*sum[0]+sum[1]*sum[1]+sum[2]*sum[2]);
+                if (f_mag == 0.)
+                    f_mag = 1.;
                 normal.x = force.x / f_mag;
                 normal.y = force.y / f_mag;
                 normal.z = force.z / f_mag;
                 skin.normals.push_back(normal);
-
                 sum[0] = 0;
                 sum[1] = 0;
                 sum[2] = 0;
             }
+            else
+            {
+                ROS_WARN("Advait believes that this should never happen\n");
+                exit(0);
+            }
+        }			
+        else
+        {
+            force.x = sum[0];
+            force.y = sum[1];
+            force.z = sum[2];
+            skin.forces.push_back(force);
+
+            // hacky code by Advait to add normals to the
+            // SkinContact message
+            double f_mag = sqrt(sum[0]*sum[0]+sum[1]*sum[1]+sum[2]*sum[2]);
+            if (f_mag == 0.)
+                f_mag = 1.;
+            normal.x = force.x / f_mag;
+            normal.y = force.y / f_mag;
+            normal.z = force.z / f_mag;
+            skin.normals.push_back(normal);
+
+            sum[0] = 0;
+            sum[1] = 0;
+            sum[2] = 0;
         }
-
     }
 }
 
@@ -503,33 +1019,25 @@ void Simulator::create_robot()
 {
     //int num_links;
     XmlRpc::XmlRpcValue link_dimensions;
-    while (nh_.getParam("/m3/software_testbed/linkage/dimensions", link_dimensions) == false)
-        sleep(0.1);
+    wait_for_param("/m3/software_testbed/linkage/dimensions", link_dimensions);
     XmlRpc::XmlRpcValue link_pos;
-    while (nh_.getParam("/m3/software_testbed/linkage/positions", link_pos) == false)
-        sleep(0.1);
+    wait_for_param("/m3/software_testbed/linkage/positions", link_pos);
     XmlRpc::XmlRpcValue link_shapes;
-    while (nh_.getParam("/m3/software_testbed/linkage/shapes", link_shapes) == false)
-        sleep(0.1);
+    wait_for_param("/m3/software_testbed/linkage/shapes", link_shapes);
 
     XmlRpc::XmlRpcValue link_masses;
-    while (nh_.getParam("/m3/software_testbed/linkage/mass", link_masses) == false)
-        sleep(0.1);
+    wait_for_param("/m3/software_testbed/linkage/mass", link_masses);
 
-    while (nh_.getParam("/m3/software_testbed/linkage/num_links", num_links) == false)
-        sleep(0.1);
+    wait_for_param("/m3/software_testbed/linkage/num_links", num_links);
 
     //int num_jts;
-    while (nh_.getParam("/m3/software_testbed/joints/num_joints", num_jts) == false)
-        sleep(0.1);
+    wait_for_param("/m3/software_testbed/joints/num_joints", num_jts);
 
     XmlRpc::XmlRpcValue jt_stiffness;
-    while (nh_.getParam("/m3/software_testbed/joints/imped_params_stiffness", jt_stiffness) == false)
-        sleep(0.1);
+    wait_for_param("/m3/software_testbed/joints/imped_params_stiffness", jt_stiffness);
 
     XmlRpc::XmlRpcValue jt_damping;
-    while (nh_.getParam("/m3/software_testbed/joints/imped_params_damping", jt_damping) == false)
-        sleep(0.1);
+    wait_for_param("/m3/software_testbed/joints/imped_params_damping", jt_damping);
     
     if ((uint)jt_stiffness.size() != k_p.size())
     {
@@ -543,29 +1051,25 @@ void Simulator::create_robot()
       assert(false);
     }
 
-    m.lock();
+    std::vector<double> init_k_p(num_jts);
+    std::vector<double> init_k_d(num_jts);
     for (int ii = 0; ii < num_jts; ii++)
     {
-      k_p[ii] = (double)jt_stiffness[ii];
-      k_d[ii] = (double)jt_damping[ii];
+      init_k_p[ii] = (double)jt_stiffness[ii];
+      init_k_d[ii] = (double)jt_damping[ii];
     }
-    m.unlock();
+    commands.set_impedance(init_k_p, init_k_d);
 
     XmlRpc::XmlRpcValue jt_min;
-    while (nh_.getParam("/m3/software_testbed/joints/min", jt_min) == false)
-        sleep(0.1);
+    wait_for_param("/m3/software_testbed/joints/min", jt_min);
     XmlRpc::XmlRpcValue jt_max;
-    while (nh_.getParam("/m3/software_testbed/joints/max", jt_max) == false)
-        sleep(0.1);
+    wait_for_param("/m3/software_testbed/joints/max", jt_max);
     XmlRpc::XmlRpcValue jt_axes;
-    while (nh_.getParam("/m3/software_testbed/joints/axes", jt_axes) == false)
-        sleep(0.1);
+    wait_for_param("/m3/software_testbed/joints/axes", jt_axes);
     XmlRpc::XmlRpcValue jt_anchor;
-    while (nh_.getParam("/m3/software_testbed/joints/anchor", jt_anchor) == false)
-        sleep(0.1);
+    wait_for_param("/m3/software_testbed/joints/anchor", jt_anchor);
     XmlRpc::XmlRpcValue jt_attach;
-    while (nh_.getParam("m3/software_testbed/joints/attach", jt_attach) == false)
-        sleep(0.1);
+    wait_for_param("m3/software_testbed/joints/attach", jt_attach);
 
 
     dMatrix3 body_rotate = {1, 0, 0, 0, 0, 0, 1, 0, 0, -1, 0, 0};
@@ -586,16 +1090,20 @@ void Simulator::create_robot()
         {
             dMassSetBoxTotal(&mass, (double)link_masses[ii], (double)link_dimensions[ii][0], (double)link_dimensions[ii][1], (double)link_dimensions[ii][2]);	    
             links_arr[ii].setMass(mass);
-            g_link_box[ii].create(space, (double)link_dimensions[ii][0], (double)link_dimensions[ii][1], (double)link_dimensions[ii][2]);
+            g_link_box[ii].create(arm_space, (double)link_dimensions[ii][0], (double)link_dimensions[ii][1], (double)link_dimensions[ii][2]);
             g_link_box[ii].setBody(links_arr[ii]);
+            g_link_box[ii].setCategoryBits(ARM_CATEGORY);
+            g_link_box[ii].setCollideBits(MOVABLE_CATEGORY | STATIC_CATEGORY);
 
         }
         else if (links_shape[ii] == "capsule")
         {
             dMassSetCapsuleTotal(&mass, (double)link_masses[ii], 3, (double)link_dimensions[ii][0]/2.0, (double)link_dimensions[ii][2]);
             links_arr[ii].setMass(mass);
-            g_link_cap[ii].create(space, (double)link_dimensions[ii][0]/2.0, (double)link_dimensions[ii][2]);
+            g_link_cap[ii].create(arm_space, (double)link_dimensions[ii][0]/2.0, (double)link_dimensions[ii][2]);
             g_link_cap[ii].setBody(links_arr[ii]);
+            g_link_cap[ii].setCategoryBits(ARM_CATEGORY);
+            g_link_cap[ii].setCollideBits(MOVABLE_CATEGORY | STATIC_CATEGORY);
         }
         else
         {
@@ -604,8 +1112,21 @@ void Simulator::create_robot()
         }
         links_arr[ii].setRotation(body_rotate);
         link_ids[ii] = links_arr[ii].id();
+
+        // nearCallback gets the link of a geom from its data.
+        link_index[ii] = ii;
+        if (links_shape[ii] == "cube")
+            g_link_box[ii].setData(&link_index[ii]);
+        else
+            g_link_cap[ii].setData(&link_index[ii]);
+        std::stringstream ss;
+        ss <<"link"<<ii+1;
+        link_names.push_back(ss.str());
     }
 
+    // the taxels do not move w.r.t their link.
+    init_taxel_layout();
+
     for (int ii = 0; ii < num_jts; ii++)
     {
         if (true)
@@ -675,12 +1196,20 @@ void Simulator::create_robot()
 
 void Simulator::calc_torques()
 {
-    m.lock();
+    // the latest command, if there is a new one. Same sizes, so the
+    // copies do not allocate.
+    if (commands.update() == true)
+    {
+        const JointCommand &c = commands.current();
+        jep = c.jep;
+        k_p = c.k_p;
+        k_d = c.k_d;
+    }
+
     for (int ii = 0; ii < num_jts; ii++)
     {
         torques[ii]=(-k_p[ii]*(q[ii]-jep[ii]) - k_d[ii]*q_dot[ii]);	
     }
-    m.unlock();
 }
 
 void Simulator::set_torques()
@@ -695,492 +1224,1028 @@ void Simulator::set_torques()
     // manip_rev_jts[2].addTorque(torques[2]);
 }
 
-void Simulator::update_linkage_viz()
+// the arrays of draw are sized by init_viz, the poses are written
+// in place.
+void Simulator::update_linkage_viz(const SensorSnapshot &s)
 {
-    hrl_msgs::FloatArrayBare link_pos_ar;
-    hrl_msgs::FloatArrayBare link_rot_ar;
-
-    const dReal *position = links_arr[0].getPosition();
-    const dReal *rotation = links_arr[0].getRotation();
-    std::vector<double> pos_vec(3);
-    std::vector<double> rot_vec(12);
     for (int l = 0; l<num_links; l++)
     {
-        position = dBodyGetPosition(link_ids[l]);
-        rotation = dBodyGetRotation(link_ids[l]);
-        pos_vec[0] = position[0];
-        pos_vec[1] = position[1];
-        pos_vec[2] = position[2];
-        link_pos_ar.data = pos_vec;
-        draw.link_loc.push_back(link_pos_ar);
+        const double *position = &s.link_pose[15*l];
+        const double *rotation = position + 3;
+        std::vector<double> &pos = draw.link_loc[l].data;
+        std::vector<double> &rot = draw.link_rot[l].data;
+        for (int k = 0; k<3; k++)
+            pos[k] = position[k];
         for (int k = 0; k<12; k++)
-        {
-            rot_vec[k] = rotation[k];
-        }
-        link_rot_ar.data = rot_vec;
-        draw.link_rot.push_back(link_rot_ar);
+            rot[k] = rotation[k];
     }
 }
 
-void Simulator::update_friction_and_obstacles()
+// movable and compliant obstacles that moved more than the tolerance
+// since they were last published go into draw, with their index in
+// obst_ids. Disabled obstacles are checked too, one may have moved
+// after the last publish and then gone to sleep. All of them are
+// sent on a keyframe.
+void Simulator::update_obstacle_viz(const SensorSnapshot &s)
 {
-    hrl_msgs::FloatArrayBare obst_pos_ar;
-    hrl_msgs::FloatArrayBare obst_rot_ar;
-    const dReal *position;
-    const dReal *rotation;
-
-    std::vector<double> pos_vec(3);
-    std::vector<double> rot_vec(12);
+    bool all = s.time >= viz_next_keyframe;
+    if (all == true)
+        viz_next_keyframe = s.time + viz_keyframe_period;
 
-    for (int l = 0; l<num_used_movable; l++)
+    int n = 0;
+    for (int l = 0; l<obst.num_dynamic(); l++)
     {
-        const dReal *tot_force = dBodyGetForce(obstacles[l].id());
-        dReal *fric_force = frict_feedbacks[l].fb.f1;
-        double force_xy_mag = sqrt((tot_force[0]-fric_force[0])*(tot_force[0]-fric_force[0])
-                +(tot_force[1]-fric_force[1])*(tot_force[1]-fric_force[1]));
-        if (force_xy_mag>0)
+        const double *position = &s.obst_pose[15*l];
+        const double *rotation = position + 3;
+        double *sent = &viz_sent_pose[15*l];
+        if (all == false)
         {
-            dJointSetPlane2DXParam(plane2d_joint_ids[l], dParamFMax, 
-                    max_friction*abs(tot_force[0]-fric_force[0])/force_xy_mag);
-            dJointSetPlane2DYParam(plane2d_joint_ids[l], dParamFMax, 
-                    max_friction*abs(tot_force[1]-fric_force[1])/force_xy_mag);
+            bool moved = false;
+            for (int k = 0; k<3 && moved == false; k++)
+                moved = fabs(position[k] - sent[k]) > viz_pos_tolerance;
+            for (int k = 0; k<12 && moved == false; k++)
+                moved = fabs(rotation[k] - sent[3+k]) > viz_rot_tolerance;
+            if (moved == false)
+                continue;
         }
-        else
+
+        // elements left from the last publish are reused, new ones
+        // are only needed when more obstacles move than then.
+        if (n == (int)draw.obst_loc.size())
         {
-            dJointSetPlane2DXParam(plane2d_joint_ids[l], dParamFMax, 
-                    max_friction*0.707);
-            dJointSetPlane2DYParam(plane2d_joint_ids[l], dParamFMax, 
-                    max_friction*0.707);
+            draw.obst_loc.resize(n+1);
+            draw.obst_rot.resize(n+1);
+            draw.obst_ids.resize(n+1);
         }
+        draw.obst_loc[n].data.assign(position, position+3);
+        draw.obst_rot[n].data.assign(rotation, rotation+12);
+        draw.obst_ids[n] = l;
+        n++;
 
-        dJointSetPlane2DAngleParam(plane2d_joint_ids[l], dParamFMax, max_tor_friction);
-        dJointSetPlane2DXParam(plane2d_joint_ids[l], dParamVel, 0.0);
-        dJointSetPlane2DYParam(plane2d_joint_ids[l], dParamVel, 0.0);
-        dJointSetPlane2DAngleParam(plane2d_joint_ids[l], dParamVel, 0.0);
-
-        position = dBodyGetPosition(obstacles[l].id());
-        rotation = dBodyGetRotation(obstacles[l].id());
-        pos_vec[0] = position[0];
-        pos_vec[1] = position[1];
-        pos_vec[2] = position[2];
-        obst_pos_ar.data = pos_vec;
-        draw.obst_loc.push_back(obst_pos_ar);
+        for (int k = 0; k<3; k++)
+            sent[k] = position[k];
         for (int k = 0; k<12; k++)
-        {
-            rot_vec[k] = rotation[k];
-        }
-        obst_rot_ar.data = rot_vec;
-        draw.obst_rot.push_back(obst_rot_ar);
+            sent[3+k] = rotation[k];
     }
 
-    for (int l = 0; l<num_used_compliant; l++)
-    {
-        dJointSetPlane2DXParam(compliant_plane2d_joint_ids[l], dParamFMax, 0);
-        dJointSetPlane2DYParam(compliant_plane2d_joint_ids[l], dParamFMax, 0);
-        const dReal *cur_pos;
-        cur_pos = dBodyGetPosition(compliant_obstacles[l].id());
-        const dReal *cur_vel;
-        cur_vel = dBodyGetLinearVel(compliant_obstacles[l].id());
-        rotation = dBodyGetRotation(compliant_obstacles[l].id());  //this is to initialize correctly
-
-        //this is the control law used to simulate compliant objects with critical damping
-        dReal Fx = (obst_home[l][0]-cur_pos[0])*obst_stiffness[l] - cur_vel[0]*obst_damping[l];
-        dReal Fy = (obst_home[l][1]-cur_pos[1])*obst_stiffness[l] - cur_vel[1]*obst_damping[l];
-
-        dBodyAddForce(compliant_obstacles[l].id(), Fx, Fy, 0);
-        //dBodyAddForce(compliant_obstacles[l].id(), 0, 0, 0);
-
-        pos_vec[0] = cur_pos[0];
-        pos_vec[1] = cur_pos[1];
-        pos_vec[2] = cur_pos[2];
+    draw.obst_loc.resize(n);
+    draw.obst_rot.resize(n);
+    draw.obst_ids.resize(n);
+}
 
-        obst_pos_ar.data = pos_vec;
-        draw.obst_loc.push_back(obst_pos_ar);
+// sizes the BodyDraw messages once. The fixed obstacles do not move,
+// they are published once on the latched static topic, with the
+// indices after the movable and compliant obstacles.
+void Simulator::init_viz()
+{
+    draw.link_loc.resize(num_links);
+    draw.link_rot.resize(num_links);
+    for (int l = 0; l<num_links; l++)
+    {
+        draw.link_loc[l].data.resize(3);
+        draw.link_rot[l].data.resize(12);
+    }
 
-        for (int k = 0; k<12; k++)
-        {
-            rot_vec[k] = rotation[k];
-        }
+    draw.obst_loc.reserve(obst.num_dynamic());
+    draw.obst_rot.reserve(obst.num_dynamic());
+    draw.obst_ids.reserve(obst.num_dynamic());
+    viz_sent_pose.assign(15*obst.num_dynamic(), 0.);
+    viz_next_keyframe = 0.;
 
-        obst_rot_ar.data = rot_vec;
-        draw.obst_rot.push_back(obst_rot_ar);
-    }
+    static_draw.obst_loc = fixed_obst_loc;
+    static_draw.obst_rot = fixed_obst_rot;
+    static_draw.obst_ids.resize(fixed_obst_loc.size());
+    for (unsigned int i = 0; i<fixed_obst_loc.size(); i++)
+        static_draw.obst_ids[i] = obst.num_dynamic() + i;
 
-    for (int l = 0; l<num_used_fixed; l++)
+    if (headless == false)
     {
-        position = dBodyGetPosition(fixed_obstacles[l].id());
-        rotation = dBodyGetRotation(fixed_obstacles[l].id());
-        pos_vec[0] = position[0];
-        pos_vec[1] = position[1];
-        pos_vec[2] = position[2];
-        obst_pos_ar.data = pos_vec;
-        draw.obst_loc.push_back(obst_pos_ar);
-        for (int k = 0; k<12; k++)
-        {
-            rot_vec[k] = rotation[k];
-        }
-        obst_rot_ar.data = rot_vec;
-        draw.obst_rot.push_back(obst_rot_ar);
+        static_draw.header.frame_id = "/world";
+        static_draw.header.stamp = ros::Time::now();
+        static_bodies_draw.publish(static_draw);
     }
 }
 
-void Simulator::publish_imped_skin_viz()
-{
-    impedance_params.header.frame_id = "/world";  //"/torso_lift_link";
-    impedance_params.header.stamp = ros::Time::now();
-    m.lock();
-    impedance_params.k_p.data = k_p;
-    impedance_params.k_d.data = k_d;
-    m.unlock();
-    imped_pub.publish(impedance_params);
-    skin.header.frame_id = "/torso_lift_link";  //"/torso_lift_link";
-    skin.header.stamp = ros::Time::now();
-    skin_pub.publish(skin);
-    draw.header.frame_id = "/world";
-    draw.header.stamp = ros::Time::now();
-    bodies_draw.publish(draw);
-    force_taxel_pub.publish(force_taxel);
-    proximity_taxel_pub.publish(proximity_taxel);
-}
-
-void Simulator::setup_current_taxel_config(hrl_haptic_manipulation_in_clutter_msgs::TaxelArray &taxel)
+void Simulator::update_friction_and_obstacles()
 {
-    taxel.header.frame_id = "/world";
-    taxel.header.stamp = ros::Time::now();
-    std::vector < string > taxel_links;
-
-    for (int ii = 0; ii<num_links; ii++)
+    for (int l = 0; l<obst.num_movable; l++)
     {
-        int k = 0;
-        float link_width = links_dim[ii][0];
-        float link_length = links_dim[ii][2];
-        int num = floor(resolution*links_dim[ii][2])+1;  //LOOK HERE: this means that I need to rotate boxes too, or use y value instead?
-        float step = 1.0/resolution;
-        std::stringstream link_name;
-        link_name << "link" << (ii+1);
-        dVector3 global_pt;
-        dVector3 global_n;
-
-        while (k < num)
+        dBodyID body = obst.body[l];
+        dJointID jt = obst.plane2d_joint[l];
+
+        // a resting obstacle has no force on it and has not moved.
+        if (!dBodyIsEnabled(body))
+            continue;
+
+        // the friction only has to be recomputed if the obstacle
+        // touched something (dirty) or is still sliding (friction
+        // force). Otherwise the default params from the last update
+        // are still set.
+        dReal *fric_force = obst.plane2d_feedback[l].f1;
+        bool sliding = (fric_force[0] != 0 || fric_force[1] != 0);
+        if (obst.dirty[l] || sliding || !obst.default_friction[l])
         {
-            if (k < 2)
+            const dReal *tot_force = dBodyGetForce(body);
+            double max_fric = obst.friction_limit[l];
+            double force_xy_mag = sqrt((tot_force[0]-fric_force[0])*(tot_force[0]-fric_force[0])
+                    +(tot_force[1]-fric_force[1])*(tot_force[1]-fric_force[1]));
+            if (force_xy_mag>0)
             {
-                dBodyGetRelPointPos(links_arr[ii].id(), link_width/2.0,  0.0, (k/2)*step, global_pt);
-                taxel.centers_x.push_back(global_pt[0]);
-                taxel.centers_y.push_back(global_pt[1]);
-                taxel.centers_z.push_back(global_pt[2]);
-                taxel.link_names.push_back(link_name.str());
-                taxel_links.push_back(link_name.str());
-
-                dBodyGetRelPointPos(links_arr[ii].id(), -link_width/2.0, 0.0, (k/2)*step, global_pt);
-                taxel.centers_x.push_back(global_pt[0]);
-                taxel.centers_y.push_back(global_pt[1]);
-                taxel.centers_z.push_back(global_pt[2]);
-                taxel.link_names.push_back(link_name.str());
-                taxel_links.push_back(link_name.str());
-
-                dBodyVectorToWorld (links_arr[ii].id(), 1.0, 0.0, 0.0, global_n);
-                taxel.normals_x.push_back(global_n[0]);
-                taxel.normals_y.push_back(global_n[1]);
-                taxel.normals_z.push_back(global_n[2]);
-
-                dBodyVectorToWorld (links_arr[ii].id(), -1.0, 0.0, 0.0, global_n);
-                taxel.normals_x.push_back(global_n[0]);
-                taxel.normals_y.push_back(global_n[1]);
-                taxel.normals_z.push_back(global_n[2]);
+                dJointSetPlane2DXParam(jt, dParamFMax, 
+                        max_fric*abs(tot_force[0]-fric_force[0])/force_xy_mag);
+                dJointSetPlane2DYParam(jt, dParamFMax, 
+                        max_fric*abs(tot_force[1]-fric_force[1])/force_xy_mag);
+                obst.default_friction[l] = 0;
             }
             else
             {
-                dBodyGetRelPointPos(links_arr[ii].id(), link_width/2.0, 0.0, (k/2)*step, global_pt);
-                taxel.centers_x.push_back(global_pt[0]);
-                taxel.centers_y.push_back(global_pt[1]);
-                taxel.centers_z.push_back(global_pt[2]);
-                taxel.link_names.push_back(link_name.str());
-                taxel_links.push_back(link_name.str());
-
-                dBodyGetRelPointPos(links_arr[ii].id(), -link_width/2.0, 0.0, (k/2)*step, global_pt);
-                taxel.centers_x.push_back(global_pt[0]);
-                taxel.centers_y.push_back(global_pt[1]);
-                taxel.centers_z.push_back(global_pt[2]);
-                taxel.link_names.push_back(link_name.str());
-                taxel_links.push_back(link_name.str());
-
-
-                dBodyGetRelPointPos(links_arr[ii].id(), link_width/2.0, 0.0, -(k/2)*step, global_pt);
-                taxel.centers_x.push_back(global_pt[0]);
-                taxel.centers_y.push_back(global_pt[1]);
-                taxel.centers_z.push_back(global_pt[2]);
-                taxel.link_names.push_back(link_name.str());
-                taxel_links.push_back(link_name.str());
-
-                dBodyGetRelPointPos(links_arr[ii].id(), -link_width/2.0, 0.0, -(k/2)*step, global_pt);
-                taxel.centers_x.push_back(global_pt[0]);
-                taxel.centers_y.push_back(global_pt[1]);
-                taxel.centers_z.push_back(global_pt[2]);
-                taxel.link_names.push_back(link_name.str());
-                taxel_links.push_back(link_name.str());
-
-                dBodyVectorToWorld (links_arr[ii].id(), 1.0, 0.0, 0.0, global_n);
-                taxel.normals_x.push_back(global_n[0]);
-                taxel.normals_y.push_back(global_n[1]);
-                taxel.normals_z.push_back(global_n[2]);
-
-                dBodyVectorToWorld (links_arr[ii].id(), -1.0, 0.0, 0.0, global_n);
-                taxel.normals_x.push_back(global_n[0]);
-                taxel.normals_y.push_back(global_n[1]);
-                taxel.normals_z.push_back(global_n[2]);
-
-                dBodyVectorToWorld (links_arr[ii].id(), 1.0, 0.0, 0.0, global_n);
-                taxel.normals_x.push_back(global_n[0]);
-                taxel.normals_y.push_back(global_n[1]);
-                taxel.normals_z.push_back(global_n[2]);
-
-                dBodyVectorToWorld (links_arr[ii].id(), -1.0, 0.0, 0.0, global_n);
-                taxel.normals_x.push_back(global_n[0]);
-                taxel.normals_y.push_back(global_n[1]);
-                taxel.normals_z.push_back(global_n[2]);
+                dJointSetPlane2DXParam(jt, dParamFMax, 
+                        max_fric*0.707);
+                dJointSetPlane2DYParam(jt, dParamFMax, 
+                        max_fric*0.707);
+                obst.default_friction[l] = 1;
             }
-            k = k+2;
-        }
 
-        if (links_shape[ii] == "cube")
-        {
-            k = 0;
-            num = floor(resolution*(link_width+0.0001))+1;
-
-            while (k < num)
-            {
-                if (k < 2)
-                {
-                    dBodyGetRelPointPos(links_arr[ii].id(), (k/2)*step,  0.0, link_length/2.0, global_pt);
-                    taxel.centers_x.push_back(global_pt[0]);
-                    taxel.centers_y.push_back(global_pt[1]);
-                    taxel.centers_z.push_back(global_pt[2]);
-                    taxel.link_names.push_back(link_name.str());
-                    taxel_links.push_back(link_name.str());
-
-                    dBodyGetRelPointPos(links_arr[ii].id(), (k/2)*step, 0.0, -link_length/2.0, global_pt);
-                    taxel.centers_x.push_back(global_pt[0]);
-                    taxel.centers_y.push_back(global_pt[1]);
-                    taxel.centers_z.push_back(global_pt[2]);
-                    taxel.link_names.push_back(link_name.str());
-                    taxel_links.push_back(link_name.str());
-
-                    dBodyVectorToWorld (links_arr[ii].id(), 0.0, 0.0, 1.0, global_n);
-                    taxel.normals_x.push_back(global_n[0]);
-                    taxel.normals_y.push_back(global_n[1]);
-                    taxel.normals_z.push_back(global_n[2]);
-
-                    dBodyVectorToWorld (links_arr[ii].id(), 0.0, 0.0, -1.0, global_n);
-                    taxel.normals_x.push_back(global_n[0]);
-                    taxel.normals_y.push_back(global_n[1]);
-                    taxel.normals_z.push_back(global_n[2]);
-                }
-                else
-                {
-                    dBodyGetRelPointPos(links_arr[ii].id(), (k/2)*step, 0.0, link_length/2.0, global_pt);
-                    taxel.centers_x.push_back(global_pt[0]);
-                    taxel.centers_y.push_back(global_pt[1]);
-                    taxel.centers_z.push_back(global_pt[2]);
-                    taxel.link_names.push_back(link_name.str());
-                    taxel_links.push_back(link_name.str());
-
-                    dBodyGetRelPointPos(links_arr[ii].id(), (k/2)*step, 0.0, -link_length/2.0, global_pt);
-                    taxel.centers_x.push_back(global_pt[0]);
-                    taxel.centers_y.push_back(global_pt[1]);
-                    taxel.centers_z.push_back(global_pt[2]);
-                    taxel.link_names.push_back(link_name.str());
-                    taxel_links.push_back(link_name.str());
-
-
-                    dBodyGetRelPointPos(links_arr[ii].id(), -(k/2)*step, 0.0, link_length/2.0, global_pt);
-                    taxel.centers_x.push_back(global_pt[0]);
-                    taxel.centers_y.push_back(global_pt[1]);
-                    taxel.centers_z.push_back(global_pt[2]);
-                    taxel.link_names.push_back(link_name.str());
-                    taxel_links.push_back(link_name.str());
-
-                    dBodyGetRelPointPos(links_arr[ii].id(), -(k/2)*step, 0.0, -link_length/2.0, global_pt);
-                    taxel.centers_x.push_back(global_pt[0]);
-                    taxel.centers_y.push_back(global_pt[1]);
-                    taxel.centers_z.push_back(global_pt[2]);
-                    taxel.link_names.push_back(link_name.str());
-                    taxel_links.push_back(link_name.str());
-
-                    dBodyVectorToWorld (links_arr[ii].id(), 0.0, 0.0, 1.0, global_n);
-                    taxel.normals_x.push_back(global_n[0]);
-                    taxel.normals_y.push_back(global_n[1]);
-                    taxel.normals_z.push_back(global_n[2]);
-
-                    dBodyVectorToWorld (links_arr[ii].id(), 0.0, 0.0, -1.0, global_n);
-                    taxel.normals_x.push_back(global_n[0]);
-                    taxel.normals_y.push_back(global_n[1]);
-                    taxel.normals_z.push_back(global_n[2]);
-
-                    dBodyVectorToWorld (links_arr[ii].id(), 0.0, 0.0, 1.0, global_n);
-                    taxel.normals_x.push_back(global_n[0]);
-                    taxel.normals_y.push_back(global_n[1]);
-                    taxel.normals_z.push_back(global_n[2]);
-
-                    dBodyVectorToWorld (links_arr[ii].id(), 0.0, 0.0, -1.0, global_n);
-                    taxel.normals_x.push_back(global_n[0]);
-                    taxel.normals_y.push_back(global_n[1]);
-                    taxel.normals_z.push_back(global_n[2]);
-                }
-                k = k+2;
-            }
-        }
-        else if (links_shape[ii] == "capsule")
-        {
-            float radius = link_width/2.0;
-            k = 0;
-            num = floor(resolution*(PI*radius))+1;
-            float ang_step = PI/(num);
-            while (k < num)
-            {
-                if (k < 2)
-                {
-                    dBodyGetRelPointPos(links_arr[ii].id(), 0.0,  0.0, link_length/2.0+radius, global_pt);
-                    taxel.centers_x.push_back(global_pt[0]);
-                    taxel.centers_y.push_back(global_pt[1]);
-                    taxel.centers_z.push_back(global_pt[2]);
-                    taxel.link_names.push_back(link_name.str());
-                    taxel_links.push_back(link_name.str());
-
-                    dBodyGetRelPointPos(links_arr[ii].id(), 0.0, 0.0, -link_length/2.0-radius, global_pt);
-                    taxel.centers_x.push_back(global_pt[0]);
-                    taxel.centers_y.push_back(global_pt[1]);
-                    taxel.centers_z.push_back(global_pt[2]);
-                    taxel.link_names.push_back(link_name.str());
-                    taxel_links.push_back(link_name.str());
-
-                    dBodyVectorToWorld (links_arr[ii].id(), 0.0, 0.0, 1.0, global_n);
-                    taxel.normals_x.push_back(global_n[0]);
-                    taxel.normals_y.push_back(global_n[1]);
-                    taxel.normals_z.push_back(global_n[2]);
-
-                    dBodyVectorToWorld (links_arr[ii].id(), 0.0, 0.0, -1.0, global_n);
-                    taxel.normals_x.push_back(global_n[0]);
-                    taxel.normals_y.push_back(global_n[1]);
-                    taxel.normals_z.push_back(global_n[2]);
-                }
-                else
-                {
-                    dBodyGetRelPointPos(links_arr[ii].id(), radius*sin(ang_step*(k/2)),  0.0, link_length/2.0+radius*cos(ang_step*(k/2)), global_pt);
-                    taxel.centers_x.push_back(global_pt[0]);
-                    taxel.centers_y.push_back(global_pt[1]);
-                    taxel.centers_z.push_back(global_pt[2]);
-                    taxel.link_names.push_back(link_name.str());
-                    taxel_links.push_back(link_name.str());
-
-                    dBodyGetRelPointPos(links_arr[ii].id(), radius*sin(ang_step*(k/2)),  0.0, -link_length/2.0-radius*cos(ang_step*(k/2)), global_pt);
-                    taxel.centers_x.push_back(global_pt[0]);
-                    taxel.centers_y.push_back(global_pt[1]);
-                    taxel.centers_z.push_back(global_pt[2]);
-                    taxel.link_names.push_back(link_name.str());
-                    taxel_links.push_back(link_name.str());
-
-                    dBodyGetRelPointPos(links_arr[ii].id(), radius*sin(-ang_step*(k/2)),  0.0, link_length/2.0+radius*cos(-ang_step*(k/2)), global_pt);
-                    taxel.centers_x.push_back(global_pt[0]);
-                    taxel.centers_y.push_back(global_pt[1]);
-                    taxel.centers_z.push_back(global_pt[2]);
-                    taxel.link_names.push_back(link_name.str());
-                    taxel_links.push_back(link_name.str());
-
-                    dBodyGetRelPointPos(links_arr[ii].id(), radius*sin(-ang_step*(k/2)),  0.0, -link_length/2.0-radius*cos(-ang_step*(k/2)), global_pt);
-                    taxel.centers_x.push_back(global_pt[0]);
-                    taxel.centers_y.push_back(global_pt[1]);
-                    taxel.centers_z.push_back(global_pt[2]);
-                    taxel.link_names.push_back(link_name.str());
-                    taxel_links.push_back(link_name.str());
-
-                    dBodyVectorToWorld (links_arr[ii].id(), sin(ang_step*(k/2)), 0.0, cos(ang_step*(k/2)), global_n);
-                    taxel.normals_x.push_back(global_n[0]);
-                    taxel.normals_y.push_back(global_n[1]);
-                    taxel.normals_z.push_back(global_n[2]);
-
-                    dBodyVectorToWorld (links_arr[ii].id(), sin(ang_step*(k/2)), 0.0, -cos(ang_step*(k/2)), global_n);
-                    taxel.normals_x.push_back(global_n[0]);
-                    taxel.normals_y.push_back(global_n[1]);
-                    taxel.normals_z.push_back(global_n[2]);
-
-                    dBodyVectorToWorld (links_arr[ii].id(), sin(-ang_step*(k/2)), 0.0, cos(-ang_step*(k/2)), global_n);
-                    taxel.normals_x.push_back(global_n[0]);
-                    taxel.normals_y.push_back(global_n[1]);
-                    taxel.normals_z.push_back(global_n[2]);
-
-                    dBodyVectorToWorld (links_arr[ii].id(), sin(-ang_step*(k/2)), 0.0, -cos(-ang_step*(k/2)), global_n);
-                    taxel.normals_x.push_back(global_n[0]);
-                    taxel.normals_y.push_back(global_n[1]);
-                    taxel.normals_z.push_back(global_n[2]);
-                }
-                k = k+2;
-            }
+            dJointSetPlane2DAngleParam(jt, dParamFMax, max_tor_friction);
+            dJointSetPlane2DXParam(jt, dParamVel, 0.0);
+            dJointSetPlane2DYParam(jt, dParamVel, 0.0);
+            dJointSetPlane2DAngleParam(jt, dParamVel, 0.0);
+            obst.dirty[l] = 0;
         }
     }
-}
 
-double Simulator::get_dist(double x1, double y1, double x2, double y2, double radius)
-{
-  return sqrt((x1-x2)*(x1-x2) + (y1-y2)*(y1-y2)) - radius;
+    //this is the control law used to simulate compliant objects with critical damping
+    obst.apply_compliant_forces();
 }
 
-void Simulator::update_proximity_simulation()
+// one physics step. Publishing and torque updates happen at their
+// own rates, sense_skin forces a skin update on this step. The
+// caller is responsible for calling clear() afterwards.
+void Simulator::step(bool sense_skin)
 {
-  if (use_prox_sensor == true)
+#ifndef SIM_NO_PROFILING
+    double t_step = profiler_now();
+    if (diag_started == false)
     {
-      setup_current_taxel_config(proximity_taxel);
-      proximity_taxel.sensor_type = "distance";
-      
-      const dReal *position;
-      for (uint i=0; i < proximity_taxel.link_names.size(); i++)
-	{
-	  double min_dist = 0.35;
-	  double x_taxel = proximity_taxel.centers_x[i];
-	  double y_taxel = proximity_taxel.centers_y[i];
-	  double nrml_x =  proximity_taxel.normals_x[i];
-	  double nrml_y =  proximity_taxel.normals_y[i];
+        diag_wall_last = t_step;
+        diag_sim_last = cur_time;
+        diag_started = true;
+    }
+#endif
+    {
+        SIM_PROFILE(profiler, collide_phase);
+        collide();
+    }
+#ifndef SIM_NO_PROFILING
+    // the contact joints of this step are in place now. Rows: 3 per
+    // contact (normal and friction) and 5 per arm hinge, the obstacle
+    // rows are sampled once per window (count_obstacle_rows).
+    profiler.count_step(num_contacts, 3*num_contacts + 5*num_jts);
+#endif
+    {
+        SIM_PROFILE(profiler, solver_phase);
+        world_step();
+    }
+    cur_time += timestep;
 
-	  //this should be dynamic for reach object in future versions
-	  double radius = 0.01;
+    {
+        SIM_PROFILE(profiler, forces_phase);
+        sense_forces();
+    }
+    scheduler.tick();
 
-	  //check every movable, fixed and compliant obstacle within 45 degree fov of taxel for min normal dist
-	  for (int j=0; j < num_used_movable ; j++)
-	    {
-	      position = dBodyGetPosition(obstacles[j].id());
-	      double cur_dist = get_dist(position[0], position[1], x_taxel, y_taxel, radius);
-	      if ( cur_dist< min_dist)
-		{
-		  /* std::cerr << "cur_dist is smaller !!!!!!!!!!!!!!!!!!!!!!!! "<< std::endl; */
-		  /* std::cerr<<"cur dist is : \t"<< cur_dist << std::endl; */
-		  double dot_product = ((position[0]-x_taxel)*nrml_x + (position[1]-y_taxel)*nrml_y)/sqrt(pow(position[0]-x_taxel, 2) + pow(position[1]-y_taxel, 2));
+    scheduler.run(clock_task);
 
-		  if (dot_product > 0.7071)
-		    {
-		      min_dist = cur_dist;
-		    }
-		}
-	    }
-	  for (int j=0; j < num_used_fixed ; j++)
+    get_joint_data();
+    scheduler.run(joints_task);
+
+    {
+        SIM_PROFILE(profiler, obstacles_phase);
+        update_friction_and_obstacles();
+    }
+
+    sensor_request = 0;
+    scheduler.run(skin_task, sense_skin);
+    scheduler.run(proximity_task);
+    scheduler.run(viz_task);
+    {
+        SIM_PROFILE(profiler, sensors_phase);
+        dispatch_sensors();
+    }
+    scheduler.run(torque_task);
+
+    set_torques();
+
+#ifndef SIM_NO_PROFILING
+    double t_end = profiler_now();
+    profiler.record(step_phase, t_end - t_step);
+    if (headless == false && t_end - diag_wall_last >= diag_period)
+        publish_diagnostics(t_end);
+#endif
+}
+
+// constraint rows of the awake obstacles: 3 for the plane 2d joint
+// plus one per friction motor (x, y and angle for movable obstacles).
+// Joint limits are not counted. Walks all obstacles, so it is only
+// called once per diagnostics window.
+int Simulator::count_obstacle_rows()
+{
+    int rows = 0;
+    for (int l = 0; l<obst.num_dynamic(); l++)
+    {
+        if (dBodyIsEnabled(obst.body[l]))
+            rows += l < obst.num_movable ? 6 : 3;
+    }
+    return rows;
+}
+
+// step time per phase (p50, p99, max), contacts, constraint rows and
+// the real time factor since the last call.
+void Simulator::publish_diagnostics(double wall_time)
+{
+    double rtf = (cur_time - diag_sim_last)/(wall_time - diag_wall_last);
+    diag_wall_last = wall_time;
+    diag_sim_last = cur_time;
+
+    diagnostics.header.stamp = ros::Time::now();
+    diagnostics.status.resize(1);
+    diagnostic_msgs::DiagnosticStatus &st = diagnostics.status[0];
+    st.name = "sim_arm: physics step";
+    st.hardware_id = "sim_arm";
+    st.level = diagnostic_msgs::DiagnosticStatus::OK;
+    st.values.clear();
+
+    char buf[128];
+    snprintf(buf, sizeof(buf), "real time factor %.2f, %ld steps", rtf, profiler.num_steps);
+    st.message = buf;
+
+    diagnostic_msgs::KeyValue kv;
+    for (int i = 0; i<profiler.num_phases(); i++)
+    {
+        const DurationHistogram &h = profiler.phase(i);
+        kv.key = profiler.phase_name(i) + " [us]";
+        snprintf(buf, sizeof(buf), "p50 %.1f, p99 %.1f, max %.1f",
+                h.quantile(0.5)*1e6, h.quantile(0.99)*1e6, h.max*1e6);
+        kv.value = buf;
+        st.values.push_back(kv);
+    }
+
+    kv.key = "real time factor";
+    snprintf(buf, sizeof(buf), "%.3f", rtf);
+    kv.value = buf;
+    st.values.push_back(kv);
+
+    kv.key = "contacts";
+    snprintf(buf, sizeof(buf), "mean %.1f, max %d", profiler.mean_contacts(), profiler.max_contacts);
+    kv.value = buf;
+    st.values.push_back(kv);
+
+    // contact and arm rows per step, plus the rows of the obstacles
+    // that are awake now.
+    int obst_rows = count_obstacle_rows();
+    kv.key = "constraint rows";
+    snprintf(buf, sizeof(buf), "mean %.1f, max %d", profiler.mean_rows() + obst_rows,
+            profiler.max_rows + obst_rows);
+    kv.value = buf;
+    st.values.push_back(kv);
+
+    diag_queue.publish(diag_pub, diagnostics);
+    profiler.clear();
+}
+
+void Simulator::add_task(int &id, const std::string &name, double period, const boost::function<void ()> &f)
+{
+    double phase = 0.;
+    XmlRpc::XmlRpcValue rate;
+    if (get_param("/m3/software_testbed/scheduler/" + name, rate) == true)
+    {
+        scenario_value(rate[0], period);
+        scenario_value(rate[1], phase);
+    }
+    id = scheduler.add_task(name, period, phase, f);
+}
+
+void Simulator::publish_clock()
+{
+    if (headless == true)
+        return;
+    rosgraph_msgs::Clock c;
+    c.clock.sec = int(cur_time);
+    c.clock.nsec = int(1000000000*(cur_time-int(cur_time)));
+    clock_queue.publish(clock_pub, c);
+    publish_thread.wake();
+}
+
+void Simulator::publish_joint_data()
+{
+    if (headless == true)
+        return;
+    publish_angle_data();
+
+    tf::Transform tf_transform;
+    tf_transform.setOrigin(tf::Vector3(0, 0, 0.0));
+    tf_transform.setRotation(tf::Quaternion(0, 0, 0, 1.0));
+
+    tf_queue.publish(*br, tf::StampedTransform(tf_transform,
+                ros::Time::now(), "/world",
+                "/torso_lift_link"));
+    publish_thread.wake();
+}
+
+void Simulator::update_skin(SensorSnapshot &s)
+{
+    update_taxel_simulation(s);
+    if (headless == true)
+        return;
+    s.skin.header.frame_id = "/torso_lift_link";  //"/torso_lift_link";
+    s.skin.header.stamp = ros::Time::now();
+    skin_queue.publish(skin_pub, s.skin);
+    taxel_queue.publish(force_taxel_pub, force_taxel);
+}
+
+void Simulator::update_proximity(SensorSnapshot &s)
+{
+    update_proximity_simulation(s);
+    // published (empty) also without proximity sensing, as before.
+    if (headless == false)
+        taxel_queue.publish(proximity_taxel_pub, proximity_taxel);
+}
+
+void Simulator::update_viz(SensorSnapshot &s)
+{
+    if (headless == true)
+        return;
+    // the visualization is only built when it is published.
+    update_linkage_viz(s);
+    update_obstacle_viz(s);
+
+    impedance_params.header.frame_id = "/world";  //"/torso_lift_link";
+    impedance_params.header.stamp = ros::Time::now();
+    impedance_params.k_p.data = s.k_p;
+    impedance_params.k_d.data = s.k_d;
+    imped_queue.publish(imped_pub, impedance_params);
+    draw.header.frame_id = "/world";
+    draw.header.stamp = ros::Time::now();
+    draw_queue.publish(bodies_draw, draw);
+}
+
+// hands the sensor work that is due on this step to the sensor
+// thread, or does it right away if there is none.
+void Simulator::dispatch_sensors()
+{
+    if (headless == true)
+        sensor_request &= ~SENSE_VIZ;
+    if (sensor_request == 0)
+        return;
+
+    if (sensor_thread_running == false)
+    {
+        capture_sensor_snapshot(sensor_snapshot, sensor_request);
+        process_sensor_snapshot(sensor_snapshot);
+        return;
+    }
+
+    bool replaced;
+    SensorSnapshot &s = sensor_handoff.write_buffer(replaced);
+    // the work of a snapshot that was dropped is done with this one.
+    capture_sensor_snapshot(s, sensor_request | (replaced ? s.tasks : 0));
+    sensor_handoff.publish();
+}
+
+void Simulator::capture_sensor_snapshot(SensorSnapshot &s, int tasks)
+{
+    s.tasks = tasks;
+    s.time = cur_time;
+
+    s.link_pose.resize(15*num_links);
+    for (int l = 0; l<num_links; l++)
+    {
+        const dReal *position = dBodyGetPosition(link_ids[l]);
+        const dReal *rotation = dBodyGetRotation(link_ids[l]);
+        std::copy(position, position+3, &s.link_pose[15*l]);
+        std::copy(rotation, rotation+12, &s.link_pose[15*l+3]);
+    }
+
+    // without proximity sensing its stage only publishes.
+    bool prox = (tasks & SENSE_PROXIMITY) && use_prox_sensor == true;
+
+    if (prox || (tasks & SENSE_VIZ))
+    {
+        int n = obst.num_dynamic();
+        s.obst_pose.resize(15*n);
+        for (int l = 0; l<n; l++)
+        {
+            const dReal *position = dBodyGetPosition(obst.body[l]);
+            const dReal *rotation = dBodyGetRotation(obst.body[l]);
+            std::copy(position, position+3, &s.obst_pose[15*l]);
+            std::copy(rotation, rotation+12, &s.obst_pose[15*l+3]);
+        }
+    }
+
+    if (tasks & SENSE_VIZ)
+    {
+        s.k_p = k_p;
+        s.k_d = k_d;
+    }
+
+    if (tasks & SENSE_SKIN)
+    {
+        s.skin = skin;
+        s.contact_link.assign(arm_contacts.link.begin(), arm_contacts.link.begin() + arm_contacts.num_groups);
+    }
+
+    // the rays go through the collision spaces, which only the
+    // physics thread may touch.
+    if (prox && proximity_mode == "ray")
+    {
+        setup_current_taxel_config(ray_taxel, &s.link_pose[0]);
+        update_proximity_rays();
+        s.prox_ray_dist = prox_ray_dist;
+    }
+}
+
+// on the sensor thread if it runs. Each stage is timed as the run of
+// its scheduler task.
+void Simulator::process_sensor_snapshot(SensorSnapshot &s)
+{
+    double t_start = profiler_now();
+    if (s.tasks & SENSE_SKIN)
+    {
+        update_skin(s);
+        double t = profiler_now();
+        scheduler.record(skin_task, t - t_start);
+        t_start = t;
+    }
+    if (s.tasks & SENSE_PROXIMITY)
+    {
+        update_proximity(s);
+        double t = profiler_now();
+        scheduler.record(proximity_task, t - t_start);
+        t_start = t;
+    }
+    if (s.tasks & SENSE_VIZ)
+    {
+        update_viz(s);
+        scheduler.record(viz_task, profiler_now() - t_start);
+    }
+}
+
+void Simulator::sensor_worker()
+{
+    SensorSnapshot *s;
+    while ((s = sensor_handoff.take()) != NULL)
+    {
+        process_sensor_snapshot(*s);
+        sensor_handoff.release();
+        publish_thread.wake();
+    }
+}
+
+void Simulator::start_sensor_thread()
+{
+    if (headless == true || sensor_thread_running == true)
+        return;
+    sensor_thread_running = true;
+    sensor_thread = boost::thread(boost::bind(&Simulator::sensor_worker, this));
+}
+
+void Simulator::start_publish_thread()
+{
+    if (headless == true)
+        return;
+    publish_thread.start();
+}
+
+void Simulator::report_task_times()
+{
+    scheduler.report();
+    if (publish_thread.is_running() == true)
+        publish_thread.report();
+    if (sensor_thread_running == true)
+    {
+        long handed, dropped;
+        sensor_handoff.stats(handed, dropped);
+        ROS_INFO("sensor thread: %ld snapshots, %ld dropped (still busy) \n", handed, dropped);
+    }
+}
+
+// sets up the robot at its initial configuration and the obstacles.
+void Simulator::create_world()
+{
+    world.setGravity(0, 0, 0);
+
+    // make robot and go to starting configuration.
+    create_robot();
+    go_initial_position(); // initial jep defined inside this function.
+
+    // add obstacles.
+    create_movable_obstacles(); //call this first for stupid ROS param server sync.
+    create_compliant_obstacles(); 
+    create_fixed_obstacles();
+
+    // the obstacle arrays have their final size now.
+    for (int i = 0; i < obst.num_movable; i++)
+        dJointSetFeedback(obst.plane2d_joint[i], &obst.plane2d_feedback[i]);
+    for (int i = 0; i < obst.num_dynamic(); i++)
+    {
+        obst.index[i] = i;
+        dBodySetData(obst.body[i], &obst.index[i]);
+    }
+
+    // fixed obstacles are put into the proximity grid once.
+    obst_grid.init(PROXIMITY_RANGE, obst.num_dynamic() + obst.num_fixed);
+    for (int i = 0; i < obst.num_dynamic(); i++)
+    {
+        const dReal *position = dBodyGetPosition(obst.body[i]);
+        obst_grid.set_radius(i, obst.radius[i]);
+        obst_grid.set(i, position[0], position[1]);
+    }
+    for (int i = 0; i < obst.num_fixed; i++)
+    {
+        const dReal *position = dGeomGetPosition(obst.fixed_geom[i]);
+        obst_grid.set_radius(obst.num_dynamic() + i, obst.fixed_radius[i]);
+        obst_grid.set(obst.num_dynamic() + i, position[0], position[1]);
+    }
+
+    if (use_prox_sensor == true && proximity_mode == "ray")
+        create_proximity_rays();
+
+    init_viz();
+}
+
+void Simulator::set_solver(const std::string &type, int iterations, double sor)
+{
+    if (type != "step" && type != "quickstep")
+    {
+        std::cerr<<"wrong type of solver was defined in config file,"<<type<<" does not exist \n";
+        assert(false);
+    }
+    solver_type = type;
+    quickstep_iterations = iterations;
+    quickstep_sor = sor;
+    dWorldSetQuickStepNumIterations(world.id(), quickstep_iterations);
+    dWorldSetQuickStepW(world.id(), quickstep_sor);
+}
+
+void Simulator::world_step()
+{
+    if (solver_type == "quickstep")
+        world.quickStep(timestep);
+    else
+        world.step(timestep);
+}
+
+// broadphase for one step: the arm against all obstacles and the
+// movable obstacles against each other and the fixed ones.
+void Simulator::collide()
+{
+    collide(&nearCallback, this);
+}
+
+void Simulator::collide(dNearCallback *callback, void *data)
+{
+    dSpaceCollide2((dGeomID)arm_space, (dGeomID)movable_space, data, callback);
+    dSpaceCollide2((dGeomID)arm_space, (dGeomID)static_space, data, callback);
+    dSpaceCollide(movable_space, data, callback);
+    dSpaceCollide2((dGeomID)movable_space, (dGeomID)static_space, data, callback);
+}
+
+// broadphase callback that only counts the candidate pairs (a long
+// in data).
+void Simulator::countPairsCallback(void *data, dGeomID o1, dGeomID o2)
+{
+    if (dGeomIsSpace(o1) || dGeomIsSpace(o2))
+    {
+        dSpaceCollide2(o1, o2, data, &countPairsCallback);
+        return;
+    }
+    (*(long*)data)++;
+}
+
+// times the hot paths of a step on the current scene, each num_reps
+// times on the same state: nearCallback (collision detection minus a
+// broadphase that only counts pairs), then, after one world step so
+// that the contacts have forces, sense_forces, the taxel transform
+// and the skin and proximity simulation. Last num_reps full steps,
+// which move the scene on.
+void Simulator::benchmark_hot_paths(int num_reps, HotPathTimes &t)
+{
+    long num_pairs = 0;
+    double t_start = profiler_now();
+    for (int i = 0; i < num_reps; i++)
+        collide(&countPairsCallback, &num_pairs);
+    double t_broadphase = profiler_now() - t_start;
+
+    t_start = profiler_now();
+    for (int i = 0; i < num_reps; i++)
+    {
+        collide();
+        clear();
+    }
+    t.near_callback = (profiler_now() - t_start - t_broadphase)/num_reps;
+
+    collide();
+    t.contacts = num_contacts;
+    t.arm_contacts = fbnum;
+    world_step();
+
+    t_start = profiler_now();
+    for (int i = 0; i < num_reps; i++)
+    {
+        skin.forces.clear();
+        skin.normals.clear();
+        sense_forces();
+    }
+    t.sense_forces = (profiler_now() - t_start)/num_reps;
+
+    SensorSnapshot s;
+    capture_sensor_snapshot(s, SENSE_SKIN | (use_prox_sensor ? SENSE_PROXIMITY : 0));
+
+    t_start = profiler_now();
+    for (int i = 0; i < num_reps; i++)
+        setup_current_taxel_config(force_taxel, &s.link_pose[0]);
+    t.taxel_config = (profiler_now() - t_start)/num_reps;
+
+    t_start = profiler_now();
+    for (int i = 0; i < num_reps; i++)
+        update_taxel_simulation(s);
+    t.taxel_simulation = (profiler_now() - t_start)/num_reps;
+
+    t.proximity_simulation = 0.;
+    if (use_prox_sensor == true)
+    {
+        t_start = profiler_now();
+        for (int i = 0; i < num_reps; i++)
+            update_proximity_simulation(s);
+        t.proximity_simulation = (profiler_now() - t_start)/num_reps;
+    }
+    clear();
+
+    t_start = profiler_now();
+    for (int i = 0; i < num_reps; i++)
+    {
+        step();
+        clear();
+    }
+    t.step = (profiler_now() - t_start)/num_reps;
+}
+
+// times the collision detection (broadphase and nearCallback) of the
+// current scene with each type of collision space.
+void Simulator::benchmark_collision_spaces(int num_steps)
+{
+    const char *types[] = {"simple", "hash", "quadtree", "sap"};
+    dSpaceID *subspaces[] = {&arm_space, &movable_space, &static_space};
+    std::vector<dGeomID> geoms[3];
+    int num_geoms = 0;
+    for (int k = 0; k < 3; k++)
+    {
+        for (int i = 0; i < dSpaceGetNumGeoms(*subspaces[k]); i++)
+            geoms[k].push_back(dSpaceGetGeom(*subspaces[k], i));
+        num_geoms += geoms[k].size();
+    }
+
+    ROS_INFO("Collision space benchmark, %d geoms, %d steps \n", num_geoms, num_steps);
+    for (int t = 0; t < 4; t++)
+    {
+        // swap each subspace for one of this type.
+        dSpaceID original[3];
+        for (int k = 0; k < 3; k++)
+        {
+            original[k] = *subspaces[k];
+            *subspaces[k] = create_space(types[t], 0);
+            for (unsigned int i = 0; i < geoms[k].size(); i++)
+            {
+                dSpaceRemove(original[k], geoms[k][i]);
+                dSpaceAdd(*subspaces[k], geoms[k][i]);
+            }
+        }
+
+        int num_arm_contacts = 0;
+        double t_start = profiler_now();
+        for (int i = 0; i < num_steps; i++)
+        {
+            collide();
+            num_arm_contacts = fbnum;
+            clear();
+        }
+        double t_collide = (profiler_now() - t_start)/num_steps;
+
+        ROS_INFO("%10s: %8.2f us per step (%d arm contacts) \n", types[t], t_collide*1e6, num_arm_contacts);
+
+        for (int k = 0; k < 3; k++)
+        {
+            for (unsigned int i = 0; i < geoms[k].size(); i++)
+            {
+                dSpaceRemove(*subspaces[k], geoms[k][i]);
+                dSpaceAdd(original[k], geoms[k][i]);
+            }
+            dSpaceDestroy(*subspaces[k]);
+            *subspaces[k] = original[k];
+        }
+    }
+}
+
+// magnitude of the largest contact force on the arm in the current
+// step.
+double Simulator::max_contact_force()
+{
+    double f_max = 0.;
+    for (unsigned int i = 0; i < skin.forces.size(); i++)
+    {
+        double f = sqrt(skin.forces[i].x*skin.forces[i].x + skin.forces[i].y*skin.forces[i].y +
+                skin.forces[i].z*skin.forces[i].z);
+        if (f > f_max)
+            f_max = f;
+    }
+    return f_max;
+}
+
+// taxel centers and normals in the frame of each link, see
+// setup_current_taxel_config.
+void Simulator::init_taxel_layout()
+{
+    taxel_layout.clear();
+
+    for (int ii = 0; ii<num_links; ii++)
+    {
+        int k = 0;
+        float link_width = links_dim[ii][0];
+        float link_length = links_dim[ii][2];
+        int num = floor(resolution*links_dim[ii][2])+1;  //LOOK HERE: this means that I need to rotate boxes too, or use y value instead?
+        float step = 1.0/resolution;
+        const std::string &link_name = link_names[ii];
+
+        while (k < num)
+        {
+            if (k < 2)
+            {
+                taxel_layout.add_center(link_name, link_width/2.0, 0.0, (k/2)*step);
+                taxel_layout.add_center(link_name, -link_width/2.0, 0.0, (k/2)*step);
+
+                taxel_layout.add_normal(1.0, 0.0, 0.0);
+                taxel_layout.add_normal(-1.0, 0.0, 0.0);
+            }
+            else
+            {
+                taxel_layout.add_center(link_name, link_width/2.0, 0.0, (k/2)*step);
+                taxel_layout.add_center(link_name, -link_width/2.0, 0.0, (k/2)*step);
+                taxel_layout.add_center(link_name, link_width/2.0, 0.0, -(k/2)*step);
+                taxel_layout.add_center(link_name, -link_width/2.0, 0.0, -(k/2)*step);
+
+                taxel_layout.add_normal(1.0, 0.0, 0.0);
+                taxel_layout.add_normal(-1.0, 0.0, 0.0);
+                taxel_layout.add_normal(1.0, 0.0, 0.0);
+                taxel_layout.add_normal(-1.0, 0.0, 0.0);
+            }
+            k = k+2;
+        }
+
+        if (links_shape[ii] == "cube")
+        {
+            k = 0;
+            num = floor(resolution*(link_width+0.0001))+1;
+
+            while (k < num)
+            {
+                if (k < 2)
+                {
+                    taxel_layout.add_center(link_name, (k/2)*step, 0.0, link_length/2.0);
+                    taxel_layout.add_center(link_name, (k/2)*step, 0.0, -link_length/2.0);
+
+                    taxel_layout.add_normal(0.0, 0.0, 1.0);
+                    taxel_layout.add_normal(0.0, 0.0, -1.0);
+                }
+                else
+                {
+                    taxel_layout.add_center(link_name, (k/2)*step, 0.0, link_length/2.0);
+                    taxel_layout.add_center(link_name, (k/2)*step, 0.0, -link_length/2.0);
+                    taxel_layout.add_center(link_name, -(k/2)*step, 0.0, link_length/2.0);
+                    taxel_layout.add_center(link_name, -(k/2)*step, 0.0, -link_length/2.0);
+
+                    taxel_layout.add_normal(0.0, 0.0, 1.0);
+                    taxel_layout.add_normal(0.0, 0.0, -1.0);
+                    taxel_layout.add_normal(0.0, 0.0, 1.0);
+                    taxel_layout.add_normal(0.0, 0.0, -1.0);
+                }
+                k = k+2;
+            }
+        }
+        else if (links_shape[ii] == "capsule")
+        {
+            float radius = link_width/2.0;
+            k = 0;
+            num = floor(resolution*(PI*radius))+1;
+            float ang_step = PI/(num);
+            while (k < num)
+            {
+                if (k < 2)
+                {
+                    taxel_layout.add_center(link_name, 0.0, 0.0, link_length/2.0+radius);
+                    taxel_layout.add_center(link_name, 0.0, 0.0, -link_length/2.0-radius);
+
+                    taxel_layout.add_normal(0.0, 0.0, 1.0);
+                    taxel_layout.add_normal(0.0, 0.0, -1.0);
+                }
+                else
+                {
+                    taxel_layout.add_center(link_name, radius*sin(ang_step*(k/2)), 0.0, link_length/2.0+radius*cos(ang_step*(k/2)));
+                    taxel_layout.add_center(link_name, radius*sin(ang_step*(k/2)), 0.0, -link_length/2.0-radius*cos(ang_step*(k/2)));
+                    taxel_layout.add_center(link_name, radius*sin(-ang_step*(k/2)), 0.0, link_length/2.0+radius*cos(-ang_step*(k/2)));
+                    taxel_layout.add_center(link_name, radius*sin(-ang_step*(k/2)), 0.0, -link_length/2.0-radius*cos(-ang_step*(k/2)));
+
+                    taxel_layout.add_normal(sin(ang_step*(k/2)), 0.0, cos(ang_step*(k/2)));
+                    taxel_layout.add_normal(sin(ang_step*(k/2)), 0.0, -cos(ang_step*(k/2)));
+                    taxel_layout.add_normal(sin(-ang_step*(k/2)), 0.0, cos(-ang_step*(k/2)));
+                    taxel_layout.add_normal(sin(-ang_step*(k/2)), 0.0, -cos(-ang_step*(k/2)));
+                }
+                k = k+2;
+            }
+        }
+
+        if (taxel_layout.end_link() == false)
+        {
+            std::cerr<<"taxel layout of "<<link_name<<" has not as many normals as centers \n";
+            assert(false);
+        }
+    }
+}
+
+// moves the taxels of each link from the layout to the world with
+// the link poses of a snapshot. taxel is only resized when the
+// layout changes.
+void Simulator::setup_current_taxel_config(hrl_haptic_manipulation_in_clutter_msgs::TaxelArray &taxel, const double *link_pose)
+{
+    taxel.header.frame_id = "/world";
+    taxel.header.stamp = ros::Time::now();
+
+    int n = taxel_layout.size();
+    if ((int)taxel.link_names.size() != n)
+    {
+        taxel.centers_x.resize(n);
+        taxel.centers_y.resize(n);
+        taxel.centers_z.resize(n);
+        taxel.normals_x.resize(n);
+        taxel.normals_y.resize(n);
+        taxel.normals_z.resize(n);
+        taxel.link_names = taxel_layout.link_names;
+    }
+
+    for (int ii = 0; ii<taxel_layout.num_links(); ii++)
+    {
+        int f = taxel_layout.first[ii];
+        int num = taxel_layout.first[ii+1] - f;
+        if (num == 0)
+            continue;
+        const double *pos = link_pose + 15*ii;
+        const double *R = pos + 3;
+        body_to_world(num, R, pos, &taxel_layout.center_x[f], &taxel_layout.center_y[f], &taxel_layout.center_z[f],
+                &taxel.centers_x[f], &taxel.centers_y[f], &taxel.centers_z[f]);
+        body_to_world(num, R, NULL, &taxel_layout.normal_x[f], &taxel_layout.normal_y[f], &taxel_layout.normal_z[f],
+                &taxel.normals_x[f], &taxel.normals_y[f], &taxel.normals_z[f]);
+    }
+}
+
+double Simulator::get_dist(double x1, double y1, double x2, double y2, double radius)
+{
+  return sqrt((x1-x2)*(x1-x2) + (y1-y2)*(y1-y2)) - radius;
+}
+
+// rays_per_taxel rays per taxel, spread over its 45 degree field of
+// view in the xy plane.
+void Simulator::create_proximity_rays()
+{
+    ray_space = create_space(space_type, 0);
+
+    int n = taxel_layout.size()*rays_per_taxel;
+    prox_rays.resize(n);
+    prox_ray_taxel.resize(n);
+    prox_ray_dist.resize(taxel_layout.size());
+    prox_ray_cos.resize(rays_per_taxel);
+    prox_ray_sin.resize(rays_per_taxel);
+    for (int r = 0; r < rays_per_taxel; r++)
+    {
+        double a = 0.;
+        if (rays_per_taxel > 1)
+            a = -PI/4 + r*(PI/2)/(rays_per_taxel-1);
+        prox_ray_cos[r] = cos(a);
+        prox_ray_sin[r] = sin(a);
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        prox_rays[i] = dCreateRay(ray_space, PROXIMITY_RANGE);
+        prox_ray_taxel[i] = i/rays_per_taxel;
+        dGeomSetData(prox_rays[i], &prox_ray_taxel[i]);
+        dGeomSetCategoryBits(prox_rays[i], RAY_CATEGORY);
+        dGeomSetCollideBits(prox_rays[i], MOVABLE_CATEGORY | STATIC_CATEGORY);
+    }
+}
+
+// nearest hit of each proximity ray, the depth of a ray contact is
+// its distance from the start of the ray.
+void Simulator::rayCallback(void *data, dGeomID o1, dGeomID o2)
+{
+    if (dGeomIsSpace(o1) || dGeomIsSpace(o2))
+    {
+        dSpaceCollide2(o1, o2, data, &rayCallback);
+        return;
+    }
+
+    Simulator* obj = (Simulator*) data;
+    dGeomID ray = (dGeomGetClass(o1) == dRayClass) ? o1 : o2;
+    dContactGeom contact;
+    if (dCollide(o1, o2, 1, &contact, sizeof(dContactGeom)) > 0)
+    {
+        int taxel = *(int*) dGeomGetData(ray);
+        if (contact.depth < obj->prox_ray_dist[taxel])
+            obj->prox_ray_dist[taxel] = contact.depth;
+    }
+}
+
+// all rays are moved to their taxels (ray_taxel) and collided with
+// the obstacle spaces at once, the broadphase picks the obstacles close to a ray
+// and the distance is to the surface of the obstacle.
+void Simulator::update_proximity_rays()
+{
+    int num_taxels = ray_taxel.link_names.size();
+    for (int i = 0; i < num_taxels; i++)
+    {
+        prox_ray_dist[i] = PROXIMITY_RANGE;
+        double x_taxel = ray_taxel.centers_x[i];
+        double y_taxel = ray_taxel.centers_y[i];
+        double z_taxel = ray_taxel.centers_z[i];
+        double nrml_x =  ray_taxel.normals_x[i];
+        double nrml_y =  ray_taxel.normals_y[i];
+        double mag = sqrt(nrml_x*nrml_x + nrml_y*nrml_y);
+
+        for (int r = 0; r < rays_per_taxel; r++)
+        {
+            dGeomID ray = prox_rays[i*rays_per_taxel + r];
+            // the taxel does not look into the plane.
+            if (mag == 0)
+            {
+                dGeomDisable(ray);
+                continue;
+            }
+            dGeomEnable(ray);
+            double dx = (prox_ray_cos[r]*nrml_x - prox_ray_sin[r]*nrml_y)/mag;
+            double dy = (prox_ray_sin[r]*nrml_x + prox_ray_cos[r]*nrml_y)/mag;
+            dGeomRaySet(ray, x_taxel, y_taxel, z_taxel, dx, dy, 0.);
+        }
+    }
+
+    dSpaceCollide2((dGeomID)ray_space, (dGeomID)movable_space, this, &rayCallback);
+    dSpaceCollide2((dGeomID)ray_space, (dGeomID)static_space, this, &rayCallback);
+}
+
+void Simulator::update_proximity_simulation(const SensorSnapshot &s)
+{
+  if (use_prox_sensor == true)
+    {
+      setup_current_taxel_config(proximity_taxel, &s.link_pose[0]);
+      proximity_taxel.sensor_type = "distance";
+      proximity_taxel.values_x.clear();
+      proximity_taxel.values_y.clear();
+      proximity_taxel.values_z.clear();
+
+      // the rays were cast when the snapshot was taken.
+      if (proximity_mode == "ray")
+	{
+	  for (uint i=0; i < proximity_taxel.link_names.size(); i++)
 	    {
-	      position = dBodyGetPosition(fixed_obstacles[j].id());
-	      double cur_dist = get_dist(position[0], position[1], x_taxel, y_taxel, radius);
-	      if ( cur_dist< min_dist)
-		{
-		  double dot_product = ((position[0]-x_taxel)*nrml_x + (position[1]-y_taxel)*nrml_y)/sqrt(pow(position[0]-x_taxel, 2) + pow(position[1]-y_taxel, 2));
-		  if (dot_product > 0.7071)
-		    {
-		      min_dist = cur_dist;
-		    }
-		}
+	      proximity_taxel.values_x.push_back(s.prox_ray_dist[i]*proximity_taxel.normals_x[i]);
+	      proximity_taxel.values_y.push_back(s.prox_ray_dist[i]*proximity_taxel.normals_y[i]);
+	      proximity_taxel.values_z.push_back(0.);
 	    }
-	  for (int j=0; j < num_used_compliant ; j++)
+	  return;
+	}
+
+      // an obstacle may have moved and gone to sleep since the last
+      // proximity update, so all are set. set only re-buckets an
+      // obstacle that changed cells.
+      for (int j=0; j < obst.num_dynamic(); j++)
+	obst_grid.set(j, s.obst_pose[15*j], s.obst_pose[15*j+1]);
+
+      for (uint i=0; i < proximity_taxel.link_names.size(); i++)
+	{
+	  double min_dist = PROXIMITY_RANGE;
+	  double x_taxel = proximity_taxel.centers_x[i];
+	  double y_taxel = proximity_taxel.centers_y[i];
+	  double nrml_x =  proximity_taxel.normals_x[i];
+	  double nrml_y =  proximity_taxel.normals_y[i];
+
+	  //check every obstacle close to the taxel and within 45 degree fov of taxel for min normal dist
+	  obst_grid.query(x_taxel, y_taxel, nrml_x, nrml_y, PROXIMITY_RANGE, prox_candidates);
+	  for (unsigned int c=0; c < prox_candidates.size(); c++)
 	    {
-	      position = dBodyGetPosition(compliant_obstacles[j].id());
-	      double cur_dist = get_dist(position[0], position[1], x_taxel, y_taxel, radius);
+	      int j = prox_candidates[c];
+	      double x_obst = obst_grid.x[j];
+	      double y_obst = obst_grid.y[j];
+	      double cur_dist = get_dist(x_obst, y_obst, x_taxel, y_taxel, obst_grid.radius[j]);
 	      if ( cur_dist< min_dist)
 		{
-		  double dot_product = ((position[0]-x_taxel)*nrml_x + (position[1]-y_taxel)*nrml_y)/sqrt(pow(position[0]-x_taxel, 2) + pow(position[1]-y_taxel, 2));
+		  double dot_product = ((x_obst-x_taxel)*nrml_x + (y_obst-y_taxel)*nrml_y)/sqrt(pow(x_obst-x_taxel, 2) + pow(y_obst-y_taxel, 2));
 		  if (dot_product > 0.7071)
 		    {
 		      min_dist = cur_dist;
@@ -1195,16 +2260,94 @@ void Simulator::update_proximity_simulation()
     }    
 }	       
 
-void Simulator::update_taxel_simulation()
+// here the force is close to a corner. only using taxels for which
+// the angle b/w the normal and the force vector is less than some
+// threshold (45 deg). acos is only needed close to the threshold.
+bool Simulator::taxel_within_angle(int k, const geometry_msgs::Vector3 &force)
+{
+    double mag_force = sqrt(force.x*force.x + force.y*force.y);
+    if (mag_force < 0.01)
+        return true;
+
+    double dot_prod = (force_taxel.normals_x[k]*force.x + force_taxel.normals_y[k]*force.y);
+    // at least 90 deg (or no normal in the plane).
+    if (!(dot_prod > 0))
+        return false;
+
+    double mag_norm = sqrt(force_taxel.normals_x[k]*force_taxel.normals_x[k]+force_taxel.normals_y[k]*force_taxel.normals_y[k]);
+    double cos_angle = dot_prod/(mag_norm*mag_force);
+    // cos(45 deg) = 0.70711
+    if (cos_angle > 0.7072 && cos_angle <= 1.)
+        return true;
+    if (cos_angle < 0.7070)
+        return false;
+    double abs_angle_deg = abs(acos(cos_angle) * 180.0 / PI);
+    return abs_angle_deg <= 45.0;
+}
+
+// the taxel of link l that is closest to the contact at loc and within
+// the angle of the force, -1 if there is none. The taxels of the link
+// are visited in the order of their distance to the contact along the
+// link axis, which is a lower bound of their distance, until no
+// closer one is left. Distances are compared as floats and ties go
+// to the lower index, so this finds the same taxel as a search over
+// all taxels in index order.
+int Simulator::nearest_taxel(int l, const geometry_msgs::Point &loc, const geometry_msgs::Vector3 &force, const double *link_pose)
 {
-    setup_current_taxel_config(force_taxel);
+    const TaxelLayout &tl = taxel_layout;
+    // contact in the link frame, R^T*(loc - pos). Only z is needed.
+    const double *pos = link_pose + 15*l;
+    const double *R = pos + 3;
+    double rel[3];
+    rel[2] = R[2]*(loc.x-pos[0]) + R[6]*(loc.y-pos[1]) + R[10]*(loc.z-pos[2]);
+
+    int b = tl.first[l];
+    int e = tl.first[l+1];
+    int hi = std::lower_bound(tl.axis_z.begin()+b, tl.axis_z.begin()+e, (double)rel[2]) - tl.axis_z.begin();
+    int lo = hi-1;
+
+    float min_distance = 10000;
+    int ind = -1;
+    while (lo >= b || hi < e)
+    {
+        double dz_lo = lo >= b ? rel[2] - tl.axis_z[lo] : 1e30;
+        double dz_hi = hi < e ? tl.axis_z[hi] - rel[2] : 1e30;
+        int s;
+        if (dz_lo <= dz_hi)
+            s = lo--;
+        else
+            s = hi++;
+
+        // margin for the rounding of the float distance and of the
+        // frame transforms.
+        if (std::min(dz_lo, dz_hi) > min_distance*(1+1e-6) + 1e-6)
+            break;
+
+        int k = tl.axis_order[s];
+        float distance = sqrt(pow((force_taxel.centers_x[k]-loc.x),2)+pow((force_taxel.centers_y[k]-loc.y),2)+pow((force_taxel.centers_z[k]-loc.z),2));
+        if (distance > min_distance || (distance == min_distance && k > ind))
+            continue;
+        if (taxel_within_angle(k, force) == false)
+            continue;
+        min_distance = distance;
+        ind = k;
+    }
+    return ind;
+}
+
+void Simulator::update_taxel_simulation(const SensorSnapshot &s)
+{
+    const hrl_haptic_manipulation_in_clutter_msgs::SkinContact &skin = s.skin;
+    setup_current_taxel_config(force_taxel, &s.link_pose[0]);
     force_taxel.sensor_type = "force";
+    force_taxel.values_x.clear();
+    force_taxel.values_y.clear();
+    force_taxel.values_z.clear();
 
     //doing nearest neighbor to assign forces to discrete taxels
     std::vector < int > f_ind;
     for (unsigned int j = 0; j < skin.forces.size(); j++)
     {
-        float min_distance = 10000;
         // sometimes the magnitude of the contact force is zero. This
         // causes ind_buf to be erroneously set to 0. In the skin
         // client (python code -- epc_skin.py), Advait is ignoring
@@ -1218,38 +2361,10 @@ void Simulator::update_taxel_simulation()
         // the link_names, locations and forces consistent. Removing
         // low forces in the python skin client appears to be an
         // okayish solution.
-        int ind_buf = -134241;
-
-        for (unsigned int k = 0; k <  force_taxel.centers_x.size(); k++)
-        {
-            float distance = sqrt(pow((force_taxel.centers_x[k]-skin.locations[j].x),2)+pow((force_taxel.centers_y[k]-skin.locations[j].y),2)+pow((force_taxel.centers_z[k]-skin.locations[j].z),2));
-            if (distance < min_distance && force_taxel.link_names[k] == skin.link_names[j])
-            {
-                double mag_norm = sqrt(force_taxel.normals_x[k]*force_taxel.normals_x[k]+force_taxel.normals_y[k]*force_taxel.normals_y[k]);
-                double mag_force = sqrt(skin.forces[j].x*skin.forces[j].x + skin.forces[j].y*skin.forces[j].y);
-
-                double dot_prod = (force_taxel.normals_x[k]*skin.forces[j].x + force_taxel.normals_y[k]*skin.forces[j].y);
-                double cos_angle = dot_prod/(mag_norm*mag_force);
-                double abs_angle_deg = abs(acos(cos_angle) * 180.0 / PI);
-
-                if (mag_force < 0.01)
-                    abs_angle_deg = 0.;
-
-                // here the force is close to a corner. only
-                // using taxels for which the angle b/w the normal
-                // and the force vector is less than some
-                // threshold.
-                if (abs_angle_deg <= 45.0)
-                {
-                    // we are guaranteed to have atleast one such
-                    // taxel, because we have at least one taxel
-                    // on both the front and side surfaces of the
-                    // arm.
-                    min_distance = distance;
-                    ind_buf = k;
-                }
-            }
-        }
+        // we are guaranteed to have atleast one taxel within the
+        // angle, because we have at least one taxel on both the
+        // front and side surfaces of the arm.
+        int ind_buf = nearest_taxel(s.contact_link[j], skin.locations[j], skin.forces[j], &s.link_pose[0]);
 
         assert(ind_buf >= 0);
         f_ind.push_back(ind_buf);
@@ -1277,46 +2392,18 @@ void Simulator::update_taxel_simulation()
 
 void Simulator::clear()
 {
-    draw.link_loc.clear();
-    draw.link_rot.clear();
-    draw.obst_loc.clear();
-    draw.obst_rot.clear();
-
-    force_taxel.centers_x.clear();
-    force_taxel.centers_y.clear();
-    force_taxel.centers_z.clear();
-    force_taxel.normals_x.clear();
-    force_taxel.normals_y.clear();
-    force_taxel.normals_z.clear();
-    force_taxel.values_x.clear();
-    force_taxel.values_y.clear();
-    force_taxel.values_z.clear();
-    force_taxel.link_names.clear();
-
-    proximity_taxel.centers_x.clear();
-    proximity_taxel.centers_y.clear();
-    proximity_taxel.centers_z.clear();
-    proximity_taxel.normals_x.clear();
-    proximity_taxel.normals_y.clear();
-    proximity_taxel.normals_z.clear();
-    proximity_taxel.values_x.clear();
-    proximity_taxel.values_y.clear();
-    proximity_taxel.values_z.clear();
-    proximity_taxel.link_names.clear();
-
-    skin.pts_x.clear();
-    skin.pts_y.clear();
-    skin.pts_z.clear();
-    skin.link_names.clear();
-    skin.locations.clear();
+
+    // the per contact arrays of skin are resized (not cleared) in
+    // sense_forces so that their buffers are reused.
     skin.forces.clear();
     skin.normals.clear();
-    force_grouping.clear();
-    force_sign.clear();
     joints.clear();	
 
     fbnum = 0;
     force_group = 0;
+    num_contacts = 0;
+    arm_contacts.num_groups = 0;
+    arm_contacts.num_pts_total = 0;
 }
 
 void Simulator::get_joint_data()	
@@ -1329,9 +2416,7 @@ void Simulator::get_joint_data()
 
     angles.data = q;
     angle_rates.data = q_dot;
-    m.lock();   
     jep_ros.data = jep;
-    m.unlock();
 }
 
 void Simulator::create_movable_obstacles()
@@ -1341,56 +2426,60 @@ void Simulator::create_movable_obstacles()
     // this needs to be the first param that is read for
     // synchronization with obstacles.py
     XmlRpc::XmlRpcValue cylinders_dim;
-    while (nh_.getParam("/m3/software_testbed/movable_dimen", cylinders_dim) == false)
-        sleep(0.1);
+    wait_for_param("/m3/software_testbed/movable_dimen", cylinders_dim);
 
     XmlRpc::XmlRpcValue cylinders_pos;
-    while (nh_.getParam("/m3/software_testbed/movable_position", cylinders_pos) == false)
-        sleep(0.1);
+    wait_for_param("/m3/software_testbed/movable_position", cylinders_pos);
 
-    while(nh_.getParam("/m3/software_testbed/num_movable", num_used_movable) == false)
-        sleep(0.1);
+    wait_for_param("/m3/software_testbed/num_movable", num_used_movable);
 
     XmlRpc::XmlRpcValue cylinders_max_force;     
     bool got_max_force;
-    got_max_force = nh_.getParam("/m3/software_testbed/movable_max_force", cylinders_max_force);
+    got_max_force = get_param("/m3/software_testbed/movable_max_force", cylinders_max_force);
+
+    XmlRpc::XmlRpcValue auto_disable;
+    get_param("/m3/software_testbed/auto_disable/movable", auto_disable);
+
+    obst.resize_dynamic(num_used_movable, 0);
 
     for (int i = 0; i < num_used_movable; i++)
     {
         dMass m_obst;
-        dCapsule *geom_cyl;
 
         dMassSetCapsuleTotal(&m_obst, obstacle_mass, 3,
                 (double)cylinders_dim[i][0], (double)cylinders_dim[i][2]);
 
-        obstacles[i].create(world);
-        obstacles[i].setPosition((double)cylinders_pos[i][0], (double)cylinders_pos[i][1], (double)cylinders_pos[i][2]);
-        obstacles[i].setMass(&m_obst);
-        plane2d_joint_ids[i] = dJointCreatePlane2D(world.id(), 0);
-        dJointAttach(plane2d_joint_ids[i], obstacles[i].id(), 0);
+        dBodyID body = dBodyCreate(world.id());
+        dBodySetPosition(body, (double)cylinders_pos[i][0], (double)cylinders_pos[i][1], (double)cylinders_pos[i][2]);
+        dBodySetMass(body, &m_obst);
+        dJointID jt = dJointCreatePlane2D(world.id(), 0);
+        dJointAttach(jt, body, 0);
 
         if (got_max_force == false)
-        {
-            dJointSetPlane2DXParam(plane2d_joint_ids[i], dParamFMax, max_friction*0.707);
-            dJointSetPlane2DYParam(plane2d_joint_ids[i], dParamFMax, max_friction*0.707);
-            dJointSetPlane2DAngleParam(plane2d_joint_ids[i], dParamFMax, max_tor_friction);
-        }
+            obst.friction_limit[i] = max_friction;
         else
-        {
-            dJointSetPlane2DXParam(plane2d_joint_ids[i], dParamFMax, (double)cylinders_max_force[i]*0.707);
-            dJointSetPlane2DYParam(plane2d_joint_ids[i], dParamFMax, (double)cylinders_max_force[i]*0.707);
-            dJointSetPlane2DAngleParam(plane2d_joint_ids[i], dParamFMax, max_tor_friction);
-        }
+            obst.friction_limit[i] = (double)cylinders_max_force[i];
+
+        dJointSetPlane2DXParam(jt, dParamFMax, obst.friction_limit[i]*0.707);
+        dJointSetPlane2DYParam(jt, dParamFMax, obst.friction_limit[i]*0.707);
+        dJointSetPlane2DAngleParam(jt, dParamFMax, max_tor_friction);
 
-        dJointSetPlane2DXParam(plane2d_joint_ids[i], dParamVel, 0.0);
-        dJointSetPlane2DYParam(plane2d_joint_ids[i], dParamVel, 0.0);
-        dJointSetPlane2DAngleParam(plane2d_joint_ids[i], dParamVel, 0.0);
+        dJointSetPlane2DXParam(jt, dParamVel, 0.0);
+        dJointSetPlane2DYParam(jt, dParamVel, 0.0);
+        dJointSetPlane2DAngleParam(jt, dParamVel, 0.0);
 
-        geom_cyl = new dCapsule(space, (double)cylinders_dim[i][0], (double)cylinders_dim[i][2]);
-        geom_cyl->setBody(obstacles[i]);
+        dGeomID geom_cyl = dCreateCapsule(movable_space, (double)cylinders_dim[i][0], (double)cylinders_dim[i][2]);
+        dGeomSetBody(geom_cyl, body);
+        dGeomSetCategoryBits(geom_cyl, MOVABLE_CATEGORY);
+        dGeomSetCollideBits(geom_cyl, ARM_CATEGORY | MOVABLE_CATEGORY | STATIC_CATEGORY);
 
-        dJointSetFeedback(plane2d_joint_ids[i], &frict_feedbacks[i].fb);
-        //obstacles.push_back(obstacle);
+        // the friction feedback is set in create_world, once the
+        // obstacle arrays do not grow anymore.
+        obst.body[i] = body;
+        obst.plane2d_joint[i] = jt;
+        obst.radius[i] = (double)cylinders_dim[i][0];
+
+        set_auto_disable(body, auto_disable);
     }
 }
 
@@ -1399,106 +2488,143 @@ void Simulator::create_compliant_obstacles()
     float obstacle_mass = 1.;
 
     XmlRpc::XmlRpcValue cylinders_dim;
-    while (nh_.getParam("/m3/software_testbed/compliant_dimen", cylinders_dim) == false)
-        sleep(0.1);
+    wait_for_param("/m3/software_testbed/compliant_dimen", cylinders_dim);
 
     XmlRpc::XmlRpcValue cylinders_pos;
-    nh_.getParam("/m3/software_testbed/compliant_position", cylinders_pos);
+    get_param("/m3/software_testbed/compliant_position", cylinders_pos);
 
     XmlRpc::XmlRpcValue cylinders_stiffness;
     bool got_stiffness;
-    got_stiffness = nh_.getParam("/m3/software_testbed/compliant_stiffness_value", cylinders_stiffness);
+    got_stiffness = get_param("/m3/software_testbed/compliant_stiffness_value", cylinders_stiffness);
+
+    get_param("/m3/software_testbed/num_compliant", num_used_compliant);
 
-    nh_.getParam("/m3/software_testbed/num_compliant", num_used_compliant);
+    XmlRpc::XmlRpcValue auto_disable;
+    get_param("/m3/software_testbed/auto_disable/compliant", auto_disable);
+
+    obst.resize_dynamic(num_used_movable, num_used_compliant);
 
     for (int i = 0; i < num_used_compliant; i++)
     {
+        int c = num_used_movable + i;
         dMass m_obst;
-        dCapsule *geom_cyl;
 
         if(got_stiffness == true)
         {
-            obst_stiffness[i]= (double)cylinders_stiffness[i];
+            obst.stiffness[c]= (double)cylinders_stiffness[i];
 
             //we calculate required damping using a
             //damping ratio of 1 (critically damped)
-            obst_damping[i] = 2*sqrt(obst_stiffness[i]*obstacle_mass);
+            obst.damping[c] = 2*sqrt(obst.stiffness[c]*obstacle_mass);
         }
         else
         {
-            obst_stiffness[i]= -1;
+            obst.stiffness[c]= -1;
         }
 
         dMassSetCapsuleTotal(&m_obst, obstacle_mass, 3, (double)cylinders_dim[i][0], (double)cylinders_dim[i][2]);
-        compliant_obstacles[i].create(world);
-        compliant_obstacles[i].setPosition((double)cylinders_pos[i][0], (double)cylinders_pos[i][1], (double)cylinders_pos[i][2]);
-        obst_home[i][0] = (double)cylinders_pos[i][0];
-        obst_home[i][1] = (double)cylinders_pos[i][1];
-        obst_home[i][2] = (double)cylinders_pos[i][2];
-        compliant_obstacles[i].setMass(&m_obst);
-        compliant_plane2d_joint_ids[i] = dJointCreatePlane2D(world.id(), 0);
-        dJointAttach(compliant_plane2d_joint_ids[i], compliant_obstacles[i].id(), 0);
-        dJointSetPlane2DXParam(compliant_plane2d_joint_ids[i], dParamVel, 0.0);
-        dJointSetPlane2DYParam(compliant_plane2d_joint_ids[i], dParamVel, 0.0);
-        dJointSetPlane2DAngleParam(compliant_plane2d_joint_ids[i], dParamVel, 0.0);
-
-        geom_cyl = new dCapsule(space, (double)cylinders_dim[i][0], (double)cylinders_dim[i][2]);
-        geom_cyl->setBody(compliant_obstacles[i]);
+        dBodyID body = dBodyCreate(world.id());
+        dBodySetPosition(body, (double)cylinders_pos[i][0], (double)cylinders_pos[i][1], (double)cylinders_pos[i][2]);
+        obst.home_x[c] = (double)cylinders_pos[i][0];
+        obst.home_y[c] = (double)cylinders_pos[i][1];
+        obst.home_z[c] = (double)cylinders_pos[i][2];
+        dBodySetMass(body, &m_obst);
+        dJointID jt = dJointCreatePlane2D(world.id(), 0);
+        dJointAttach(jt, body, 0);
+        // no friction, only the spring and damper act on them.
+        dJointSetPlane2DXParam(jt, dParamFMax, 0);
+        dJointSetPlane2DYParam(jt, dParamFMax, 0);
+        dJointSetPlane2DXParam(jt, dParamVel, 0.0);
+        dJointSetPlane2DYParam(jt, dParamVel, 0.0);
+        dJointSetPlane2DAngleParam(jt, dParamVel, 0.0);
+
+        dGeomID geom_cyl = dCreateCapsule(movable_space, (double)cylinders_dim[i][0], (double)cylinders_dim[i][2]);
+        dGeomSetBody(geom_cyl, body);
+        dGeomSetCategoryBits(geom_cyl, MOVABLE_CATEGORY);
+        dGeomSetCollideBits(geom_cyl, ARM_CATEGORY | MOVABLE_CATEGORY | STATIC_CATEGORY);
+
+        obst.body[c] = body;
+        obst.plane2d_joint[c] = jt;
+        obst.radius[c] = (double)cylinders_dim[i][0];
+
+        set_auto_disable(body, auto_disable);
     }
 }
 
-void Simulator::create_fixed_obstacles()
+// lets ODE disable an obstacle once it has been at rest for a while,
+// params is a struct with linear_threshold [m/s], angular_threshold
+// [rad/s], steps and time [s]. Without params the obstacle is
+// never disabled.
+void Simulator::set_auto_disable(dBodyID body, XmlRpc::XmlRpcValue &params)
 {
-    float obstacle_mass = 1.;
+    if (params.getType() != XmlRpc::XmlRpcValue::TypeStruct)
+    {
+        dBodySetAutoDisableFlag(body, 0);
+        return;
+    }
 
-    while(nh_.getParam("/m3/software_testbed/num_fixed", num_used_fixed) == false)
-        sleep(0.1);
+    double value;
+    dBodySetAutoDisableFlag(body, 1);
+    if (params.hasMember("linear_threshold") && scenario_value(params["linear_threshold"], value))
+        dBodySetAutoDisableLinearThreshold(body, value);
+    if (params.hasMember("angular_threshold") && scenario_value(params["angular_threshold"], value))
+        dBodySetAutoDisableAngularThreshold(body, value);
+    if (params.hasMember("steps") && scenario_value(params["steps"], value))
+        dBodySetAutoDisableSteps(body, (int)value);
+    if (params.hasMember("time") && scenario_value(params["time"], value))
+        dBodySetAutoDisableTime(body, value);
+}
+
+// fixed obstacles never move, so they have no body (and no fixed
+// joint adding constraint rows to every world step). Their geoms are
+// static, live in static_space and contacts with them attach to the
+// world (body 0).
+void Simulator::create_fixed_obstacles()
+{
+    wait_for_param("/m3/software_testbed/num_fixed", num_used_fixed);
 
     XmlRpc::XmlRpcValue fixed_pos;
-    nh_.getParam("/m3/software_testbed/fixed_position", fixed_pos);
+    get_param("/m3/software_testbed/fixed_position", fixed_pos);
     XmlRpc::XmlRpcValue fixed_dim;
-    nh_.getParam("/m3/software_testbed/fixed_dimen", fixed_dim);
+    get_param("/m3/software_testbed/fixed_dimen", fixed_dim);
     XmlRpc::XmlRpcValue fixed_ctype;
-    nh_.getParam("/m3/software_testbed/fixed_ctype", fixed_ctype);
+    get_param("/m3/software_testbed/fixed_ctype", fixed_ctype);
 
+    std::vector<double> pos_vec(3);
+    std::vector<double> rot_vec(12);
+    obst.resize_fixed(num_used_fixed);
 
     for (int i = 0; i < num_used_fixed; i++)
     {
-        dMass m_obst;
-
-        dMassSetCapsuleTotal(&m_obst, obstacle_mass, 3,
-                (double)fixed_dim[i][0], (double)fixed_dim[i][2]);
-
-        fixed_obstacles[i].create(world);
-        fixed_obstacles[i].setPosition((double)fixed_pos[i][0], (double)fixed_pos[i][1], (double)fixed_pos[i][2]);
-        fixed_obstacles[i].setMass(&m_obst);
-
         if (static_cast<std::string>(fixed_ctype[i]) == "wall")
         {
-            dBox *geom_fixed;
             double theta = (double)fixed_pos[i][3];
             dMatrix3 obstacle_rotate = {cos(theta),-sin(theta),0,0,sin(theta),cos(theta),0,0,0,0,1.0,0};
-            fixed_obstacles[i].setRotation(obstacle_rotate);
-
-            fixed_joint_ids[i] = dJointCreateFixed(world.id(), 0);
-            dJointAttach(fixed_joint_ids[i], fixed_obstacles[i].id(), 0);        
-            dJointSetFixed(fixed_joint_ids[i]);
-
-            geom_fixed = new dBox(space, (double)fixed_dim[i][0], (double)fixed_dim[i][1], (double)fixed_dim[i][2]);
-            geom_fixed->setBody(fixed_obstacles[i]);
+            obst.fixed_geom[i] = dCreateBox(static_space, (double)fixed_dim[i][0], (double)fixed_dim[i][1], (double)fixed_dim[i][2]);
+            dGeomSetRotation(obst.fixed_geom[i], obstacle_rotate);
+            obst.fixed_radius[i] = std::min((double)fixed_dim[i][0], (double)fixed_dim[i][1])/2.0;
         }
         else
         {
-            dCapsule *geom_fixed;
-
-            fixed_joint_ids[i] = dJointCreateFixed(world.id(), 0);
-            dJointAttach(fixed_joint_ids[i], fixed_obstacles[i].id(), 0);        
-            dJointSetFixed(fixed_joint_ids[i]);
-
-            geom_fixed = new dCapsule(space, (double)fixed_dim[i][0], (double)fixed_dim[i][2]);
-            geom_fixed->setBody(fixed_obstacles[i]);
+            obst.fixed_geom[i] = dCreateCapsule(static_space, (double)fixed_dim[i][0], (double)fixed_dim[i][2]);
+            obst.fixed_radius[i] = (double)fixed_dim[i][0];
         }
-
-        //	fixed_obstacles.push_back(fixed_obstacle);
+        dGeomSetPosition(obst.fixed_geom[i], (double)fixed_pos[i][0], (double)fixed_pos[i][1], (double)fixed_pos[i][2]);
+        dGeomSetCategoryBits(obst.fixed_geom[i], STATIC_CATEGORY);
+        dGeomSetCollideBits(obst.fixed_geom[i], ARM_CATEGORY | MOVABLE_CATEGORY);
+
+        // the pose for the visualization only has to be read once.
+        const dReal *position = dGeomGetPosition(obst.fixed_geom[i]);
+        const dReal *rotation = dGeomGetRotation(obst.fixed_geom[i]);
+        hrl_msgs::FloatArrayBare obst_pos_ar;
+        hrl_msgs::FloatArrayBare obst_rot_ar;
+        for (int k = 0; k<3; k++)
+            pos_vec[k] = position[k];
+        for (int k = 0; k<12; k++)
+            rot_vec[k] = rotation[k];
+        obst_pos_ar.data = pos_vec;
+        obst_rot_ar.data = rot_vec;
+        fixed_obst_loc.push_back(obst_pos_ar);
+        fixed_obst_rot.push_back(obst_rot_ar);
     }
 }
@@ -0,0 +1,226 @@
+#include "simulator.h"
+#include <boost/thread.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <cstdlib>
+#include <cstdio>
+
+// Runs many independent headless simulations (each with its own ODE
+// world, collision space, contact joint group and feedback buffers)
+// on a pool of worker threads. Every scenario file (written by
+// save_scenario.py) is one trial. A scenario can contain
+//   batch/duration       : simulated time for this trial [s], used
+//                          unless -t is given (default 60 s)
+//   batch/jep_trajectory : list of [t, q_1, ..., q_n]; the jep is set
+//                          to q once the simulation time reaches t.
+// Otherwise the arm holds its initial jep.
+//
+// usage: batch_simulator [-j num_threads] [-t duration] [-o results_file] scenario_1.xml ...
+
+struct TrialResult
+{
+    bool ok;
+    int steps;
+    double sim_time;
+    double wall_time;
+    double max_force;
+    std::vector<double> q;
+};
+
+class BatchRunner
+{
+    public:
+        BatchRunner(const std::vector<std::string> &files, double duration);
+        void run(int num_threads);
+        void write_results(FILE *f);
+
+    protected:
+        void worker();
+        void run_trial(int i);
+
+        std::vector<std::string> scenario_files;
+        std::vector<TrialResult> results;
+        double default_duration; // from -t, < 0 if not given
+        int next_trial;
+        boost::mutex m;
+};
+
+BatchRunner::BatchRunner(const std::vector<std::string> &files, double duration) :
+    scenario_files(files),
+    results(files.size()),
+    default_duration(duration),
+    next_trial(0)
+{
+}
+
+void BatchRunner::run_trial(int i)
+{
+    TrialResult &r = results[i];
+    r.ok = false;
+    r.steps = 0;
+    r.sim_time = 0.;
+    r.wall_time = 0.;
+    r.max_force = 0.;
+
+    XmlRpc::XmlRpcValue scenario;
+    if (load_scenario_file(scenario_files[i], scenario) == false)
+    {
+        ROS_ERROR("Could not read scenario %s\n", scenario_files[i].c_str());
+        return;
+    }
+
+    // a missing parameter or one of the wrong type (a scenario file
+    // that is not what the simulator expects) only fails this trial.
+    try
+    {
+        double duration = default_duration;
+        if (duration < 0.)
+        {
+            duration = 60.;
+            XmlRpc::XmlRpcValue *v = find_scenario_param(scenario, "/batch/duration");
+            if (v != NULL)
+                duration = scenario_double(*v);
+        }
+        XmlRpc::XmlRpcValue *traj = find_scenario_param(scenario, "/batch/jep_trajectory");
+        int traj_ind = 0;
+        std::vector<double> jep;
+
+        double t_start = profiler_now();
+
+        // heap allocated, Simulator is too big for a thread's stack.
+        boost::scoped_ptr<Simulator> sim(new Simulator(scenario));
+        sim->create_world();
+
+        while (sim->cur_time < duration)
+        {
+            if (next_trajectory_jep(traj, traj_ind, sim->cur_time, jep))
+                sim->set_jep(jep);
+
+            sim->step();
+            r.max_force = std::max(r.max_force, sim->max_contact_force());
+            sim->clear();
+            r.steps++;
+        }
+
+        r.wall_time = profiler_now() - t_start;
+        r.sim_time = sim->cur_time;
+        r.q = sim->get_joint_angles();
+        r.ok = true;
+    }
+    catch (std::exception &e)
+    {
+        m.lock();
+        ROS_ERROR("Trial %s failed: %s\n", scenario_files[i].c_str(), e.what());
+        m.unlock();
+        return;
+    }
+    catch (XmlRpc::XmlRpcException &e)
+    {
+        m.lock();
+        ROS_ERROR("Trial %s failed: %s\n", scenario_files[i].c_str(), e.getMessage().c_str());
+        m.unlock();
+        return;
+    }
+
+    m.lock();
+    ROS_INFO("Finished %s: %.1f s simulated in %.1f s (real time factor %.2f)\n",
+            scenario_files[i].c_str(), r.sim_time, r.wall_time, r.sim_time/r.wall_time);
+    m.unlock();
+}
+
+void BatchRunner::worker()
+{
+    // ODE keeps per thread collision data.
+    dAllocateODEDataForThread(dAllocateMaskAll);
+
+    while (true)
+    {
+        m.lock();
+        int i = next_trial++;
+        m.unlock();
+
+        if (i >= (int)scenario_files.size())
+            break;
+        run_trial(i);
+    }
+
+    dCleanupODEAllDataForThread();
+}
+
+void BatchRunner::run(int num_threads)
+{
+    boost::thread_group workers;
+    for (int i = 0; i < num_threads; i++)
+        workers.create_thread(boost::bind(&BatchRunner::worker, this));
+    workers.join_all();
+}
+
+void BatchRunner::write_results(FILE *f)
+{
+    fprintf(f, "# scenario ok steps sim_time wall_time max_force q_final\n");
+    for (unsigned int i = 0; i < results.size(); i++)
+    {
+        TrialResult &r = results[i];
+        fprintf(f, "%s %d %d %f %f %f", scenario_files[i].c_str(), r.ok, r.steps,
+                r.sim_time, r.wall_time, r.max_force);
+        for (unsigned int k = 0; k < r.q.size(); k++)
+            fprintf(f, " %f", r.q[k]);
+        fprintf(f, "\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int num_threads = boost::thread::hardware_concurrency();
+    double duration = -1.; // from -t, the scenario or the default
+    std::string results_file;
+    std::vector<std::string> files;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if (arg == "-j" && i+1 < argc)
+            num_threads = atoi(argv[++i]);
+        else if (arg == "-t" && i+1 < argc)
+            duration = atof(argv[++i]);
+        else if (arg == "-o" && i+1 < argc)
+            results_file = argv[++i];
+        else
+            files.push_back(arg);
+    }
+
+    if (files.empty())
+    {
+        std::cerr << "usage: batch_simulator [-j num_threads] [-t duration] [-o results_file] scenario_1.xml ..." << std::endl;
+        return 1;
+    }
+    if (num_threads < 1)
+        num_threads = 1;
+
+    // no ROS node, but message headers are still stamped.
+    ros::Time::init();
+    dInitODE2(0);
+
+    ROS_INFO("Running %d scenarios on %d threads\n", (int)files.size(), num_threads);
+    double t_start = profiler_now();
+
+    BatchRunner runner(files, duration);
+    runner.run(num_threads);
+
+    ROS_INFO("Finished all scenarios in %.1f s\n", profiler_now() - t_start);
+
+    runner.write_results(stdout);
+    if (!results_file.empty())
+    {
+        FILE *f = fopen(results_file.c_str(), "w");
+        if (f == NULL)
+            ROS_ERROR("Could not open %s\n", results_file.c_str());
+        else
+        {
+            runner.write_results(f);
+            fclose(f);
+        }
+    }
+
+    dCloseODE();
+    return 0;
+}
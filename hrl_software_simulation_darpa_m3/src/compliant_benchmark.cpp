@@ -0,0 +1,120 @@
+#include "sim_obstacles.h"
+#include "sim_profiler.h"
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+
+// Compares the spring/damper update of the compliant obstacles done
+// per obstacle (ODE calls and the spring law in one loop, as
+// update_friction_and_obstacles used to do) with
+// ObstacleStore::apply_compliant_forces (gather, vectorized kernel,
+// scatter) for a growing number of obstacles. Only the force update
+// is timed, the world is never stepped.
+//
+// usage: compliant_benchmark [num_iterations]
+
+void scalar_compliant_forces(ObstacleStore &obst)
+{
+    for (int c = obst.num_movable; c<obst.num_dynamic(); c++)
+    {
+        dBodyID body = obst.body[c];
+        if (!dBodyIsEnabled(body))
+            continue;
+
+        const dReal *cur_pos = dBodyGetPosition(body);
+        const dReal *cur_vel = dBodyGetLinearVel(body);
+
+        dReal Fx = (obst.home_x[c]-cur_pos[0])*obst.stiffness[c] - cur_vel[0]*obst.damping[c];
+        dReal Fy = (obst.home_y[c]-cur_pos[1])*obst.stiffness[c] - cur_vel[1]*obst.damping[c];
+
+        dBodyAddForce(body, Fx, Fy, 0);
+    }
+}
+
+// n compliant obstacles displaced from their home and moving.
+void create_obstacles(dWorldID world, int n, ObstacleStore &obst)
+{
+    obst.resize_dynamic(0, n);
+    for (int c = 0; c < n; c++)
+    {
+        obst.body[c] = dBodyCreate(world);
+        obst.home_x[c] = 0.2 + 0.4*rand()/(double)RAND_MAX;
+        obst.home_y[c] = -0.5 + 0.7*rand()/(double)RAND_MAX;
+        obst.stiffness[c] = 100 + 900*rand()/(double)RAND_MAX;
+        obst.damping[c] = 2*sqrt(obst.stiffness[c]);
+        dBodySetPosition(obst.body[c], obst.home_x[c] + 0.01, obst.home_y[c] - 0.01, 0);
+        dBodySetLinearVel(obst.body[c], 0.1, -0.2, 0);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int num_iterations = 2000;
+    if (argc > 1)
+        num_iterations = atoi(argv[1]);
+    if (num_iterations < 1)
+    {
+        fprintf(stderr, "usage: compliant_benchmark [num_iterations]\n");
+        return 1;
+    }
+
+    dInitODE2(0);
+
+    printf("# %d iterations, SSE2 %s\n", num_iterations,
+#ifdef __SSE2__
+            "on"
+#else
+            "off"
+#endif
+            );
+    printf("# %10s %14s %14s %8s %12s\n", "compliant", "scalar [us]", "kernel [us]", "speedup", "max |df| [N]");
+
+    int counts[] = {10, 100, 1000, 10000};
+    for (int t = 0; t < 4; t++)
+    {
+        int n = counts[t];
+        dWorldID world = dWorldCreate();
+        ObstacleStore obst;
+        create_obstacles(world, n, obst);
+
+        double t_start = profiler_now();
+        for (int i = 0; i < num_iterations; i++)
+            scalar_compliant_forces(obst);
+        double t_scalar = (profiler_now() - t_start)/num_iterations;
+
+        // forces of one update of each version, for the difference.
+        std::vector<double> f_scalar(2*n);
+        for (int c = 0; c < n; c++)
+            dBodySetForce(obst.body[c], 0, 0, 0);
+        scalar_compliant_forces(obst);
+        for (int c = 0; c < n; c++)
+        {
+            f_scalar[2*c] = dBodyGetForce(obst.body[c])[0];
+            f_scalar[2*c+1] = dBodyGetForce(obst.body[c])[1];
+        }
+
+        t_start = profiler_now();
+        for (int i = 0; i < num_iterations; i++)
+            obst.apply_compliant_forces();
+        double t_kernel = (profiler_now() - t_start)/num_iterations;
+
+        for (int c = 0; c < n; c++)
+            dBodySetForce(obst.body[c], 0, 0, 0);
+        obst.apply_compliant_forces();
+        double df_max = 0.;
+        for (int c = 0; c < n; c++)
+        {
+            df_max = std::max(df_max, fabs(f_scalar[2*c] - dBodyGetForce(obst.body[c])[0]));
+            df_max = std::max(df_max, fabs(f_scalar[2*c+1] - dBodyGetForce(obst.body[c])[1]));
+        }
+
+        printf("%12d %14.2f %14.2f %8.2f %12.3g\n", n, t_scalar*1e6, t_kernel*1e6,
+                t_scalar/t_kernel, df_max);
+
+        dWorldDestroy(world);
+    }
+
+    dCloseODE();
+    return 0;
+}
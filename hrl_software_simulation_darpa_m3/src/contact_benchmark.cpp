@@ -0,0 +1,77 @@
+#include "simulator.h"
+#include <boost/scoped_ptr.hpp>
+#include <cstdlib>
+#include <cstdio>
+
+// Cost of Simulator::nearCallback per candidate pair on one scenario
+// (written by save_scenario.py). The broadphase of a step is run
+// num_steps times with a callback that only counts the pairs and
+// then with nearCallback (narrowphase, contact joints and skin
+// contact bookkeeping). The difference is the cost of nearCallback.
+// The world is not stepped, so every repetition sees the same
+// pairs.
+//
+// usage: contact_benchmark [-n num_steps] scenario.xml
+
+int main(int argc, char **argv)
+{
+    int num_steps = 10000;
+    std::string file;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if (arg == "-n" && i+1 < argc)
+            num_steps = atoi(argv[++i]);
+        else
+            file = arg;
+    }
+
+    if (file.empty() || num_steps < 1)
+    {
+        std::cerr << "usage: contact_benchmark [-n num_steps] scenario.xml" << std::endl;
+        return 1;
+    }
+
+    XmlRpc::XmlRpcValue scenario;
+    if (load_scenario_file(file, scenario) == false)
+    {
+        ROS_ERROR("Could not read scenario %s\n", file.c_str());
+        return 1;
+    }
+
+    ros::Time::init();
+    dInitODE2(0);
+
+    boost::scoped_ptr<Simulator> sim(new Simulator(scenario));
+    sim->create_world();
+
+    long num_pairs = 0;
+    double t_start = profiler_now();
+    for (int i = 0; i < num_steps; i++)
+        sim->collide(&Simulator::countPairsCallback, &num_pairs);
+    double t_broadphase = profiler_now() - t_start;
+    num_pairs /= num_steps;
+
+    int num_arm_contacts = 0;
+    t_start = profiler_now();
+    for (int i = 0; i < num_steps; i++)
+    {
+        sim->collide();
+        num_arm_contacts = sim->num_arm_contacts();
+        sim->clear();
+    }
+    double t_near = profiler_now() - t_start;
+
+    printf("# %s, %d steps\n", file.c_str(), num_steps);
+    printf("candidate pairs per step:    %ld\n", num_pairs);
+    printf("arm contacts per step:       %d\n", num_arm_contacts);
+    printf("broadphase per step [us]:    %.2f\n", t_broadphase/num_steps*1e6);
+    printf("collision per step [us]:     %.2f\n", t_near/num_steps*1e6);
+    if (num_pairs > 0)
+        printf("nearCallback per pair [ns]:  %.1f\n", (t_near - t_broadphase)/num_steps/num_pairs*1e9);
+
+    sim.reset();
+    dCloseODE();
+    return 0;
+}
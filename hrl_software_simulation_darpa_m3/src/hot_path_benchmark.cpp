@@ -0,0 +1,221 @@
+#include "simulator.h"
+#include <boost/scoped_ptr.hpp>
+#include <cstdlib>
+#include <cstdio>
+
+// Times the hot paths of a simulation step (see
+// Simulator::benchmark_hot_paths) on synthetic scenes of growing
+// size, to catch scaling regressions. A scene is the planar three
+// link capsule arm and n vertical capsule obstacles (movable, fixed
+// and compliant in turn) on a jittered grid around it, closest to
+// the arm first. The arm is driven through its neighbours for a
+// while before the timing so that it is in contact. No ROS master
+// is needed, the scenes are built as scenarios.
+//
+// usage: hot_path_benchmark [-r num_reps] [-w warmup_steps]
+//            [-n n,...] [-s space_type] [-p center|ray]
+
+XmlRpc::XmlRpcValue vec3(double x, double y, double z)
+{
+    XmlRpc::XmlRpcValue v;
+    v.setSize(3);
+    v[0] = x;
+    v[1] = y;
+    v[2] = z;
+    return v;
+}
+
+XmlRpc::XmlRpcValue attach_pair(int a, int b)
+{
+    XmlRpc::XmlRpcValue v;
+    v.setSize(2);
+    v[0] = a;
+    v[1] = b;
+    return v;
+}
+
+struct GridCell
+{
+    double x, y, d;
+    bool operator<(const GridCell &o) const { return d < o.d; }
+};
+
+void make_scenario(int n, const std::string &space_type, const std::string &prox_mode,
+        XmlRpc::XmlRpcValue &scenario)
+{
+    XmlRpc::XmlRpcValue &tb = scenario["m3"]["software_testbed"];
+
+    // arm along y, joints about z.
+    int num_links = 3;
+    double link_length = 0.3;
+    double link_stiffness[] = {30., 20., 15.};
+    double link_damping[] = {15., 10., 8.};
+    XmlRpc::XmlRpcValue &linkage = tb["linkage"];
+    XmlRpc::XmlRpcValue &joints = tb["joints"];
+    for (int l = 0; l < num_links; l++)
+    {
+        linkage["dimensions"][l] = vec3(0.1, 0.1, link_length);
+        linkage["positions"][l] = vec3(0., link_length*(l+0.5), 0.);
+        linkage["shapes"][l] = std::string("capsule");
+        linkage["mass"][l] = 1.;
+        joints["axes"][l] = vec3(0., 0., 1.);
+        joints["anchor"][l] = vec3(0., link_length*l, 0.);
+        joints["attach"][l] = attach_pair(l-1, l);
+        joints["min"][l] = -2.5;
+        joints["max"][l] = 2.5;
+        joints["init_angle"][l] = 0.;
+        joints["imped_params_stiffness"][l] = link_stiffness[l];
+        joints["imped_params_damping"][l] = link_damping[l];
+    }
+    linkage["num_links"] = num_links;
+    joints["num_joints"] = num_links;
+    tb["resolution"] = 100;
+    tb["collision_space"]["type"] = space_type;
+    tb["proximity"]["mode"] = prox_mode;
+    scenario["use_prox_sensor"] = true;
+
+    // 10 cm grid, cells that touch the arm are left out.
+    double spacing = 0.1;
+    double radius = 0.02;
+    int side = (int)ceil(sqrt((double)n)) + 12;
+    std::vector<GridCell> cells;
+    for (int i = 0; i < side; i++)
+    {
+        for (int j = 0; j < side; j++)
+        {
+            GridCell c;
+            c.x = (i - side/2)*spacing + spacing/2 + 0.4*spacing*(rand()/(double)RAND_MAX - 0.5);
+            c.y = (j - side/2)*spacing + 0.45 + 0.4*spacing*(rand()/(double)RAND_MAX - 0.5);
+            if (fabs(c.x) < 0.1 && c.y > -0.1 && c.y < 1.0)
+                continue;
+            c.d = (c.x*c.x + (c.y-0.45)*(c.y-0.45));
+            cells.push_back(c);
+        }
+    }
+    std::sort(cells.begin(), cells.end());
+
+    int num[3] = {0, 0, 0};
+    const char *kinds[] = {"movable", "fixed", "compliant"};
+    for (int i = 0; i < n; i++)
+    {
+        int k = i%3;
+        std::string kind = kinds[k];
+        tb[kind + "_dimen"][num[k]] = vec3(radius, radius, 0.2);
+        tb[kind + "_position"][num[k]] = vec3(cells[i].x, cells[i].y, 0.);
+        if (k == 1)
+            tb["fixed_ctype"][num[k]] = std::string("capsule");
+        if (k == 2)
+            tb["compliant_stiffness_value"][num[k]] = 200.;
+        num[k]++;
+    }
+    tb["num_movable"] = num[0];
+    tb["num_fixed"] = num[1];
+    tb["num_compliant"] = num[2];
+
+    // an empty list still has to be an array.
+    for (int k = 0; k < 3; k++)
+    {
+        if (num[k] > 0)
+            continue;
+        tb[std::string(kinds[k]) + "_dimen"].setSize(0);
+        tb[std::string(kinds[k]) + "_position"].setSize(0);
+    }
+
+    // obstacles nobody touches go to sleep, as in the larger scenes.
+    for (int k = 0; k < 3; k += 2)
+    {
+        XmlRpc::XmlRpcValue &ad = tb["auto_disable"][kinds[k]];
+        ad["linear_threshold"] = 0.001;
+        ad["angular_threshold"] = 0.01;
+        ad["steps"] = 10;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int num_reps = 200;
+    int warmup_steps = 1000;
+    std::string space_type = "hash";
+    std::string prox_mode = "center";
+    std::vector<int> sizes;
+    const char *usage = "usage: hot_path_benchmark [-r num_reps] [-w warmup_steps] [-n n,...] [-s space_type] [-p center|ray]";
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if (arg == "-r" && i+1 < argc)
+            num_reps = atoi(argv[++i]);
+        else if (arg == "-w" && i+1 < argc)
+            warmup_steps = atoi(argv[++i]);
+        else if (arg == "-s" && i+1 < argc)
+            space_type = argv[++i];
+        else if (arg == "-p" && i+1 < argc)
+            prox_mode = argv[++i];
+        else if (arg == "-n" && i+1 < argc)
+        {
+            std::stringstream ss(argv[++i]);
+            std::string n;
+            while (std::getline(ss, n, ','))
+                sizes.push_back(atoi(n.c_str()));
+        }
+        else
+        {
+            std::cerr << usage << std::endl;
+            return 1;
+        }
+    }
+
+    bool sizes_ok = true;
+    for (unsigned int k = 0; k < sizes.size(); k++)
+        sizes_ok = sizes_ok && sizes[k] >= 0;
+    if (num_reps < 1 || sizes_ok == false)
+    {
+        std::cerr << usage << std::endl;
+        return 1;
+    }
+    if (sizes.empty())
+    {
+        int default_sizes[] = {10, 100, 1000, 10000};
+        sizes.assign(default_sizes, default_sizes+4);
+    }
+
+    ros::Time::init();
+    dInitODE2(0);
+
+    printf("# %d reps, %d warmup steps, %s space, %s proximity, times in us\n",
+            num_reps, warmup_steps, space_type.c_str(), prox_mode.c_str());
+    printf("# %8s %9s %11s %13s %12s %12s %12s %12s %10s\n", "n", "contacts", "arm_contacts",
+            "nearCallback", "sense_forces", "taxel_config", "taxel_sim", "proximity", "step");
+
+    for (unsigned int k = 0; k < sizes.size(); k++)
+    {
+        srand(1);
+        XmlRpc::XmlRpcValue scenario;
+        make_scenario(sizes[k], space_type, prox_mode, scenario);
+
+        boost::scoped_ptr<Simulator> sim(new Simulator(scenario));
+        sim->create_world();
+
+        // sweep the arm into the obstacles around it.
+        std::vector<double> jep(3);
+        jep[0] = 0.6;
+        jep[1] = -0.4;
+        jep[2] = 0.3;
+        sim->set_jep(jep);
+        for (int i = 0; i < warmup_steps; i++)
+        {
+            sim->step();
+            sim->clear();
+        }
+
+        HotPathTimes t;
+        sim->benchmark_hot_paths(num_reps, t);
+        printf("%10d %9d %11d %13.2f %12.2f %12.2f %12.2f %12.2f %10.2f\n", sizes[k],
+                t.contacts, t.arm_contacts, t.near_callback*1e6, t.sense_forces*1e6,
+                t.taxel_config*1e6, t.taxel_simulation*1e6, t.proximity_simulation*1e6, t.step*1e6);
+        fflush(stdout);
+    }
+
+    dCloseODE();
+    return 0;
+}
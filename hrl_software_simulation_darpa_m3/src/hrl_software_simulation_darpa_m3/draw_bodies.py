@@ -68,8 +68,11 @@ class DrawAll:
         self.constr_jts = None
         self.links_pos = []
         self.links_rot = []
-        self.obst_pos = []
-        self.obst_rot = []
+        # indexed by obstacle id (movable, compliant, then fixed),
+        # None until the obstacle was received.
+        num_obst = int(self.num_moveable + self.num_compliant + self.num_fixed)
+        self.obst_pos = [None]*num_obst
+        self.obst_rot = [None]*num_obst
         self.draw_obstacles = ds.SceneDraw("sim/viz/obstacles", "/torso_lift_link")
         self.draw_links = ds.SceneDraw("sim/viz/linkage", "/torso_lift_link")
         self.color_active = [0, 1, 0, 1]
@@ -77,16 +80,26 @@ class DrawAll:
         self.color_passive = [0, 0, 1, 1]
         self.color_links =rospy.get_param('m3/software_testbed/linkage/colors')
         rospy.Subscriber("/sim_arm/bodies_visualization", BodyDraw, self.bodies_callback)
+        # fixed obstacles, published once (latched).
+        rospy.Subscriber("/sim_arm/static_bodies_visualization", BodyDraw, self.bodies_callback)
 
         self.goal_marker_pub = rospy.Publisher('/epc_skin/viz/goal', Marker)
 
         
     def bodies_callback(self, msg):
         with self.lock:
-            self.links_pos = msg.link_loc
-            self.links_rot = msg.link_rot
-            self.obst_pos = msg.obst_loc
-            self.obst_rot = msg.obst_rot
+            if msg.link_loc != []:
+                self.links_pos = msg.link_loc
+                self.links_rot = msg.link_rot
+            # only the obstacles that moved are sent, keyed by
+            # obst_ids. Without ids the message has all of them.
+            ids = msg.obst_ids
+            if len(ids) == 0:
+                ids = range(len(msg.obst_loc))
+            for i, obst_id in enumerate(ids):
+                if obst_id < len(self.obst_pos):
+                    self.obst_pos[obst_id] = msg.obst_loc[i]
+                    self.obst_rot[obst_id] = msg.obst_rot[i]
 
     def draw_bodies(self):
         obst_counter = 0
@@ -119,65 +132,73 @@ class DrawAll:
                                dims, color_links[i], link_counter, shape)
             link_counter = link_counter + 1
 
-        if self.obst_pos != []:
-            for i in xrange(self.num_moveable):
-                color = [0.6,0.6,0,0.7]
-                self.draw_obstacles.pub_body(self.obst_pos[i].data, 
-                                   matrix_to_quaternion(self.draw_obstacles.get_rot_mat(self.obst_rot[i].data).T),
-                                   [self.moveable_dimen[i][0]*2, self.moveable_dimen[i][1]*2, self.moveable_dimen[i][2]], 
-                                   color, 
-                                   obst_counter, 
-                                   self.draw_obstacles.Marker.CYLINDER)
+        for i in xrange(self.num_moveable):
+            if self.obst_pos[i] is None:
                 obst_counter = obst_counter + 1
-
-            for i in xrange(self.num_compliant):
-                color = [0, 100/255.0, 0, 0.9]
-                self.draw_obstacles.pub_body(self.obst_pos[self.num_moveable+i].data, 
-                                   matrix_to_quaternion(self.draw_obstacles.get_rot_mat(self.obst_rot[self.num_moveable+i].data).T),
-                                   [self.compliant_dimen[i][0]*2, self.compliant_dimen[i][1]*2, self.compliant_dimen[i][2]], 
-                                   color, 
-                                   obst_counter, 
-                                   self.draw_obstacles.Marker.CYLINDER)
+                continue
+            color = [0.6,0.6,0,0.7]
+            self.draw_obstacles.pub_body(self.obst_pos[i].data, 
+                               matrix_to_quaternion(self.draw_obstacles.get_rot_mat(self.obst_rot[i].data).T),
+                               [self.moveable_dimen[i][0]*2, self.moveable_dimen[i][1]*2, self.moveable_dimen[i][2]], 
+                               color, 
+                               obst_counter, 
+                               self.draw_obstacles.Marker.CYLINDER)
+            obst_counter = obst_counter + 1
+
+        for i in xrange(self.num_compliant):
+            if self.obst_pos[self.num_moveable+i] is None:
                 obst_counter = obst_counter + 1
-
-
-            for i in xrange(self.num_fixed):
-                color2 = [0.3, 0.,0.,0.7]
-                    
-                if self.fixed_ctype[i] == 'wall':
-                    
-                    obst_rot_mat = self.draw_links.get_rot_mat(self.obst_rot[i].data).T
-                    ## dim_jt       = [self.fixed_dimen[i][1]/2.0, self.fixed_dimen[i][1]/2.0, self.fixed_dimen[i][2]]
-
-                    ## #jt_pos_loc = link_rot_mat*np.array([0, 0, self.links_dim[i][2]/2.0]).reshape(3,1)
-                    ## #jt_pos_plus = np.array(self.links_pos[i].data).reshape(3,1) + jt_pos_loc
-                    ## #jt_pos_neg = np.array(self.links_pos[i].data).reshape(3,1) - jt_pos_loc                                    
-
-                    ## jt_pos_loc  = obst_rot_mat*np.array([0, 0, self.fixed_dimen[i][2]/2.0]).reshape(3,1)                    
-                    ## jt_pos_plus = self.obst_pos[self.num_moveable+self.num_compliant+i].data + jt_pos_loc
-                    ## jt_pos_neg  = self.obst_pos[self.num_moveable+self.num_compliant+i].data - jt_pos_loc                    
-
-                    ## self.draw_links.pub_body(jt_pos_plus, matrix_to_quaternion(obst_rot_mat), dim_jt, color_links[i], link_counter, self.draw_links.Marker.SPHERE)
-                    ## self.draw_links.pub_body(jt_pos_neg, matrix_to_quaternion(obst_rot_mat), dim_jt, color_links[i], link_counter+1, self.draw_links.Marker.SPHERE)
-                    ## link_counter=link_counter+2
-
-                    #print self.num_moveable+self.num_compliant+i
-                    #print self.obst_rot[self.num_moveable+self.num_compliant+i].data
-                    
-                    self.draw_obstacles.pub_body(self.obst_pos[self.num_moveable+self.num_compliant+i].data, 
-                                                 matrix_to_quaternion(self.draw_obstacles.get_rot_mat(self.obst_rot[self.num_moveable+self.num_compliant+i].data).T),
-                                                 [self.fixed_dimen[i][0], self.fixed_dimen[i][1], self.fixed_dimen[i][2]], 
-                                                 color2, 
-                                                 obst_counter, 
-                                                 self.draw_obstacles.Marker.CUBE)
-                else:                    
-                    self.draw_obstacles.pub_body(self.obst_pos[self.num_moveable+self.num_compliant+i].data, 
-                                                 matrix_to_quaternion(self.draw_obstacles.get_rot_mat(self.obst_rot[self.num_moveable+self.num_compliant+i].data).T),
-                                                 [self.fixed_dimen[i][0]*2, self.fixed_dimen[i][1]*2, self.fixed_dimen[i][2]], 
-                                                 color2, 
-                                                 obst_counter, 
-                                                 self.draw_obstacles.Marker.CYLINDER)
+                continue
+            color = [0, 100/255.0, 0, 0.9]
+            self.draw_obstacles.pub_body(self.obst_pos[self.num_moveable+i].data, 
+                               matrix_to_quaternion(self.draw_obstacles.get_rot_mat(self.obst_rot[self.num_moveable+i].data).T),
+                               [self.compliant_dimen[i][0]*2, self.compliant_dimen[i][1]*2, self.compliant_dimen[i][2]], 
+                               color, 
+                               obst_counter, 
+                               self.draw_obstacles.Marker.CYLINDER)
+            obst_counter = obst_counter + 1
+
+
+        for i in xrange(self.num_fixed):
+            if self.obst_pos[self.num_moveable+self.num_compliant+i] is None:
                 obst_counter = obst_counter + 1
+                continue
+            color2 = [0.3, 0.,0.,0.7]
+                
+            if self.fixed_ctype[i] == 'wall':
+                
+                obst_rot_mat = self.draw_links.get_rot_mat(self.obst_rot[self.num_moveable+self.num_compliant+i].data).T
+                ## dim_jt       = [self.fixed_dimen[i][1]/2.0, self.fixed_dimen[i][1]/2.0, self.fixed_dimen[i][2]]
+
+                ## #jt_pos_loc = link_rot_mat*np.array([0, 0, self.links_dim[i][2]/2.0]).reshape(3,1)
+                ## #jt_pos_plus = np.array(self.links_pos[i].data).reshape(3,1) + jt_pos_loc
+                ## #jt_pos_neg = np.array(self.links_pos[i].data).reshape(3,1) - jt_pos_loc                                    
+
+                ## jt_pos_loc  = obst_rot_mat*np.array([0, 0, self.fixed_dimen[i][2]/2.0]).reshape(3,1)                    
+                ## jt_pos_plus = self.obst_pos[self.num_moveable+self.num_compliant+i].data + jt_pos_loc
+                ## jt_pos_neg  = self.obst_pos[self.num_moveable+self.num_compliant+i].data - jt_pos_loc                    
+
+                ## self.draw_links.pub_body(jt_pos_plus, matrix_to_quaternion(obst_rot_mat), dim_jt, color_links[i], link_counter, self.draw_links.Marker.SPHERE)
+                ## self.draw_links.pub_body(jt_pos_neg, matrix_to_quaternion(obst_rot_mat), dim_jt, color_links[i], link_counter+1, self.draw_links.Marker.SPHERE)
+                ## link_counter=link_counter+2
+
+                #print self.num_moveable+self.num_compliant+i
+                #print self.obst_rot[self.num_moveable+self.num_compliant+i].data
+                
+                self.draw_obstacles.pub_body(self.obst_pos[self.num_moveable+self.num_compliant+i].data, 
+                                             matrix_to_quaternion(self.draw_obstacles.get_rot_mat(self.obst_rot[self.num_moveable+self.num_compliant+i].data).T),
+                                             [self.fixed_dimen[i][0], self.fixed_dimen[i][1], self.fixed_dimen[i][2]], 
+                                             color2, 
+                                             obst_counter, 
+                                             self.draw_obstacles.Marker.CUBE)
+            else:                    
+                self.draw_obstacles.pub_body(self.obst_pos[self.num_moveable+self.num_compliant+i].data, 
+                                             matrix_to_quaternion(self.draw_obstacles.get_rot_mat(self.obst_rot[self.num_moveable+self.num_compliant+i].data).T),
+                                             [self.fixed_dimen[i][0]*2, self.fixed_dimen[i][1]*2, self.fixed_dimen[i][2]], 
+                                             color2, 
+                                             obst_counter, 
+                                             self.draw_obstacles.Marker.CYLINDER)
+            obst_counter = obst_counter + 1
         #self.num_fixed = rospy.get_param('m3/software_testbed/num_fixed')
 
         self.lock.release()
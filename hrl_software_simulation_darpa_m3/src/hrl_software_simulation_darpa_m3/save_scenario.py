@@ -0,0 +1,63 @@
+#!/usr/bin/env python
+import roslib; roslib.load_manifest('hrl_software_simulation_darpa_m3')
+import rospy
+import xmlrpclib
+
+from hrl_msgs.msg import FloatArrayBare
+
+
+# saves the parameters that the simulator reads from the param server
+# (robot from sim_arm_param_upload.py, obstacles from obstacles.py)
+# as a scenario file for batch_simulator.
+def save_scenario(file_name, duration=None, jep_trajectory=None):
+    d = {}
+    d['m3'] = {'software_testbed': rospy.get_param('/m3/software_testbed')}
+    d['use_prox_sensor'] = rospy.get_param('/use_prox_sensor', False)
+    d['batch'] = {}
+    if duration != None:
+        d['batch']['duration'] = duration
+    if jep_trajectory != None:
+        d['batch']['jep_trajectory'] = jep_trajectory
+
+    f = open(file_name, 'w')
+    f.write(xmlrpclib.dumps((d,)))
+    f.close()
+
+
+# records the jeps sent to the simulator for duration seconds (sim
+# time) as [t, q_1, ..., q_n], t relative to the start of the
+# recording.
+def record_jep_trajectory(duration):
+    traj = []
+    t_start = rospy.get_time()
+
+    def jep_cb(msg):
+        traj.append([rospy.get_time() - t_start] + list(msg.data))
+
+    sub = rospy.Subscriber('/sim_arm/command/jep', FloatArrayBare, jep_cb)
+    while not rospy.is_shutdown() and rospy.get_time() - t_start < duration:
+        rospy.sleep(0.1)
+    sub.unregister()
+    return traj
+
+
+if __name__ == '__main__':
+    import optparse
+    p = optparse.OptionParser()
+
+    p.add_option('--file', action='store', dest='file_name',
+                 default='scenario.xml', help='name of the scenario file')
+    p.add_option('--duration', action='store', dest='duration', type='float',
+                 default=None, help='simulated time for this scenario in batch_simulator')
+    p.add_option('--record_jep', action='store', dest='record_jep', type='float',
+                 default=None, help='record the jeps sent to the simulator for this many seconds')
+
+    opt, args = p.parse_args()
+
+    rospy.init_node('save_scenario', anonymous=True)
+    jep_trajectory = None
+    if opt.record_jep != None:
+        jep_trajectory = record_jep_trajectory(opt.record_jep)
+        if opt.duration == None:
+            opt.duration = opt.record_jep
+    save_scenario(opt.file_name, opt.duration, jep_trajectory)
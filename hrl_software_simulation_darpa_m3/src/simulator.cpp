@@ -12,113 +12,132 @@ int main(int argc, char **argv)
 {
     ros::init(argc, argv, "sim_arm");
     ros::NodeHandle n;
+    ros::NodeHandle n_private("~");
+    dInitODE();
     Simulator simulator(n);
     ros::Subscriber sub1 = n.subscribe("/sim_arm/command/jep", 100, &Simulator::JepCallback, &simulator);
     ros::Subscriber sub2 = n.subscribe("/sim_arm/command/joint_impedance", 100, &Simulator::ImpedanceCallback, &simulator);
-    tf::TransformBroadcaster br;                                                
-    tf::Transform tf_transform;
-    int torque_step(0);
-    int q_pub_step(0);
-    int skin_step(0);
-    int clock_pub_step(0);
 
+    // pacing of the simulation w.r.t wall clock time. 1.0 is real
+    // time, 5.0 is five times faster than real time and 0 (or any
+    // non-positive value) runs the simulation as fast as possible.
+    double real_time_factor;
+    n_private.param("real_time_factor", real_time_factor, 1.0);
+
+    // achieved real time factor is reported every
+    // rtf_report_period seconds of simulated time.
+    double rtf_report_period;
+    n_private.param("rtf_report_period", rtf_report_period, 10.0);
+
+    // in lockstep mode physics steps are only taken on request
+    // (/sim_arm/step service) instead of free running.
+    bool lockstep;
+    n_private.param("lockstep", lockstep, false);
 
     ROS_INFO("Before most things \n");
 
     ROS_INFO("After getting first parameter \n");
 
-    dInitODE();
-    // setup pointers to drawstuff callback functions
-
-    simulator.world.setGravity(0, 0, 0);
+    ROS_INFO("Before create_world \n");
 
-    ROS_INFO("Before create_robot \n");
+    // robot at its starting configuration and obstacles.
+    simulator.create_world();
 
-    // make robot and go to starting configuration.
-    simulator.create_robot();
-    ROS_INFO("Before going to initial position \n");
-    simulator.go_initial_position(); // initial jep defined inside this function.
-    ROS_INFO("After going to initial position \n");
+    // time the collision detection of this scene with every type of
+    // collision space and quit.
+    int benchmark_steps;
+    n_private.param("benchmark_collision_spaces", benchmark_steps, 0);
+    if (benchmark_steps > 0)
+    {
+        simulator.benchmark_collision_spaces(benchmark_steps);
+        dCloseODE();
+        return 0;
+    }
 
-    // add obstacles.
-    simulator.create_movable_obstacles(); //call this first for stupid ROS param server sync.
-    simulator.create_compliant_obstacles(); 
-    simulator.create_fixed_obstacles();
     ROS_INFO("Starting Simulation now ... \n");
 
+    // the messages are sent by a thread of their own and the
+    // callbacks are handled by the spinner, so neither the number of
+    // subscribers nor the message sizes slow down the physics.
+    simulator.start_publish_thread();
+    ros::AsyncSpinner spinner(1);
+
+    // skin, proximity and viz are built and published on a thread of
+    // their own while the physics keeps stepping.
+    bool sensor_thread;
+    n_private.param("sensor_thread", sensor_thread, true);
+    if (lockstep == false && sensor_thread == true)
+        simulator.start_sensor_thread();
+
+    if (lockstep == false)
+    {
+        if (real_time_factor > 0)
+            ROS_INFO("Simulation paced at %.2f x real time \n", real_time_factor);
+        else
+            ROS_INFO("Simulation is not paced, running as fast as possible \n");
+    }
+
     double t_now = get_wall_clock_time() - simulator.timestep;
     double t_expected;
 
-    while (ros::ok())
+    double rtf_wall_start = get_wall_clock_time();
+    double rtf_sim_start = simulator.cur_time;
+    double rtf_wall_last = rtf_wall_start;
+    double rtf_sim_last = rtf_sim_start;
+
+    if (lockstep)
     {
-        simulator.space.collide(&simulator, &simulator.nearCallback);
+        // the simulation only advances when a controller calls
+        // /sim_arm/step. Commands on the jep and impedance topics are
+        // still accepted between calls.
+        // one spinner thread, so steps and commands are handled one
+        // after the other.
+        ros::ServiceServer step_srv = n.advertiseService("/sim_arm/step", &Simulator::StepCallback, &simulator);
+        ROS_INFO("Simulator running in lockstep mode, waiting for /sim_arm/step \n");
+
+        spinner.start();
+        ros::waitForShutdown();
+    }
+    else
+        spinner.start();
 
+    while (ros::ok() && !lockstep)
+    {
         // simulation will not run faster than real-time. - advait 2011
 	/* this section may no longer be necessary though because
 	   we are no synchronizing the mpc controller and simulation 
 	   at least in some branches of the git code. - marc Sept 2012 */
-        t_expected = t_now + simulator.timestep;
-        t_now = get_wall_clock_time();
-        if (t_now < t_expected)
-            usleep(int((t_expected - t_now)*1000000. + 0.5));
-
-        simulator.world.step(simulator.timestep);
-
-        simulator.cur_time += simulator.timestep;
-        rosgraph_msgs::Clock c;
-        c.clock.sec = int(simulator.cur_time);
-        c.clock.nsec = int(1000000000*(simulator.cur_time-int(simulator.cur_time)));
-
-        simulator.sense_forces();
-
-        clock_pub_step++;
-        torque_step++;
-        q_pub_step++;
-        skin_step++;
-
-        if (clock_pub_step >= 0.002/simulator.timestep)
-        {
-            simulator.clock_pub.publish(c);
-            clock_pub_step = 0;
-        }
-
-        simulator.get_joint_data();
-        if (q_pub_step >= 0.01/simulator.timestep)
+        // real_time_factor scales (or disables) the pacing so that
+        // batch runs are not bound by the wall clock.
+        if (real_time_factor > 0)
         {
-            simulator.publish_angle_data();
-            q_pub_step = 0;
-
-            tf_transform.setOrigin(tf::Vector3(0, 0, 0.0));
-            tf_transform.setRotation(tf::Quaternion(0, 0, 0, 1.0));
-
-            br.sendTransform(tf::StampedTransform(tf_transform,
-                        ros::Time::now(), "/world",
-                        "/torso_lift_link"));
+            t_expected = t_now + simulator.timestep/real_time_factor;
+            t_now = get_wall_clock_time();
+            if (t_now < t_expected)
+                usleep(int((t_expected - t_now)*1000000. + 0.5));
         }
 
-        simulator.update_friction_and_obstacles();
-
-        if (skin_step >= 0.01/simulator.timestep)
-        {
-            simulator.update_linkage_viz();
-            simulator.update_taxel_simulation();
-	    simulator.update_proximity_simulation();
-            simulator.publish_imped_skin_viz();
-            skin_step = 0;
-        }
+        simulator.step();
+        simulator.clear();
 
-        if (torque_step >= 0.001/simulator.timestep)
+        if (simulator.cur_time - rtf_sim_last >= rtf_report_period)
         {
-            simulator.calc_torques();
-            torque_step = 0;
+            double wall = get_wall_clock_time();
+            ROS_INFO("Real time factor: %.2f (last %.1f s), %.2f (overall) \n",
+                    (simulator.cur_time - rtf_sim_last)/(wall - rtf_wall_last),
+                    simulator.cur_time - rtf_sim_last,
+                    (simulator.cur_time - rtf_sim_start)/(wall - rtf_wall_start));
+            rtf_wall_last = wall;
+            rtf_sim_last = simulator.cur_time;
+            simulator.report_task_times();
         }
-
-        simulator.set_torques();
-        simulator.clear();
-
-        ros::spinOnce();
     }
 
+    ROS_INFO("Simulated %.1f s in %.1f s of wall time, real time factor: %.2f \n",
+            simulator.cur_time - rtf_sim_start, get_wall_clock_time() - rtf_wall_start,
+            (simulator.cur_time - rtf_sim_start)/(get_wall_clock_time() - rtf_wall_start));
+
+    spinner.stop();
     dCloseODE();
 }
 
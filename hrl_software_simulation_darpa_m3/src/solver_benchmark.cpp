@@ -0,0 +1,147 @@
+#include "simulator.h"
+#include <boost/scoped_ptr.hpp>
+#include <cstdlib>
+#include <cstdio>
+
+// Compares ODE's dense LCP solver (world.step) with QuickStep on one
+// scenario (written by save_scenario.py, with --record_jep for the
+// batch/jep_trajectory to replay). The scenario is run once with
+// world.step as the reference and then once per QuickStep iteration
+// count. Reported per run: mean wall time of a simulation step and
+// the error of the largest arm contact force w.r.t the reference
+// (mean and max over all steps), and the final joint angle error.
+//
+// usage: solver_benchmark [-t duration] [-i iterations,...] [-w sor] scenario.xml
+
+struct SolverRun
+{
+    double step_time;
+    std::vector<double> max_force; // per step
+    std::vector<double> q;
+};
+
+void run_solver(XmlRpc::XmlRpcValue &scenario, double duration,
+        const std::string &solver, int iterations, double sor, SolverRun &r)
+{
+    XmlRpc::XmlRpcValue *traj = find_scenario_param(scenario, "/batch/jep_trajectory");
+    int traj_ind = 0;
+    std::vector<double> jep;
+
+    boost::scoped_ptr<Simulator> sim(new Simulator(scenario));
+    sim->create_world();
+    sim->set_solver(solver, iterations, sor);
+
+    double t_step = 0.;
+    while (sim->cur_time < duration)
+    {
+        if (next_trajectory_jep(traj, traj_ind, sim->cur_time, jep))
+            sim->set_jep(jep);
+
+        double t_start = profiler_now();
+        sim->step();
+        t_step += profiler_now() - t_start;
+
+        r.max_force.push_back(sim->max_contact_force());
+        sim->clear();
+    }
+
+    r.step_time = t_step/r.max_force.size();
+    r.q = sim->get_joint_angles();
+}
+
+void print_run(const char *name, SolverRun &r, SolverRun &ref)
+{
+    double f_err_sum = 0.;
+    double f_err_max = 0.;
+    unsigned int n = std::min(r.max_force.size(), ref.max_force.size());
+    for (unsigned int i = 0; i < n; i++)
+    {
+        double e = fabs(r.max_force[i] - ref.max_force[i]);
+        f_err_sum += e;
+        f_err_max = std::max(f_err_max, e);
+    }
+
+    double q_err = 0.;
+    for (unsigned int i = 0; i < r.q.size() && i < ref.q.size(); i++)
+        q_err += (r.q[i] - ref.q[i])*(r.q[i] - ref.q[i]);
+
+    printf("%-16s %12.2f %8.2f %14.4f %14.4f %14.5f\n", name, r.step_time*1e6,
+            ref.step_time/r.step_time, n > 0 ? f_err_sum/n : 0., f_err_max, sqrt(q_err));
+}
+
+int main(int argc, char **argv)
+{
+    double duration = -1.; // from -t, the scenario or the default
+    double sor = 1.3;
+    std::vector<int> iterations;
+    std::string file;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if (arg == "-t" && i+1 < argc)
+            duration = atof(argv[++i]);
+        else if (arg == "-w" && i+1 < argc)
+            sor = atof(argv[++i]);
+        else if (arg == "-i" && i+1 < argc)
+        {
+            std::stringstream ss(argv[++i]);
+            std::string it;
+            while (std::getline(ss, it, ','))
+                iterations.push_back(atoi(it.c_str()));
+        }
+        else
+            file = arg;
+    }
+
+    if (file.empty())
+    {
+        std::cerr << "usage: solver_benchmark [-t duration] [-i iterations,...] [-w sor] scenario.xml" << std::endl;
+        return 1;
+    }
+    if (iterations.empty())
+    {
+        iterations.push_back(10);
+        iterations.push_back(20);
+        iterations.push_back(50);
+    }
+
+    XmlRpc::XmlRpcValue scenario;
+    if (load_scenario_file(file, scenario) == false)
+    {
+        ROS_ERROR("Could not read scenario %s\n", file.c_str());
+        return 1;
+    }
+    if (duration < 0.)
+    {
+        duration = 10.;
+        XmlRpc::XmlRpcValue *v = find_scenario_param(scenario, "/batch/duration");
+        if (v != NULL)
+            duration = scenario_double(*v);
+    }
+
+    ros::Time::init();
+    dInitODE2(0);
+
+    SolverRun ref;
+    run_solver(scenario, duration, "step", 0, sor, ref);
+
+    printf("# %s, %.1f s simulated, %d steps, sor %.2f\n", file.c_str(), duration,
+            (int)ref.max_force.size(), sor);
+    printf("# %-14s %12s %8s %14s %14s %14s\n", "solver", "step [us]", "speedup",
+            "mean f err [N]", "max f err [N]", "final q err");
+    print_run("step", ref, ref);
+
+    for (unsigned int i = 0; i < iterations.size(); i++)
+    {
+        SolverRun r;
+        run_solver(scenario, duration, "quickstep", iterations[i], sor, r);
+
+        char name[32];
+        snprintf(name, sizeof(name), "quickstep_%d", iterations[i]);
+        print_run(name, r, ref);
+    }
+
+    dCloseODE();
+    return 0;
+}
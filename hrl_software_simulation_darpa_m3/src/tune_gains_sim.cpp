@@ -110,7 +110,6 @@ int main(int argc, char **argv)
         {
             simulator.update_linkage_viz();
             simulator.update_taxel_simulation(resolution);
-            simulator.publish_imped_skin_viz();
             skin_step = 0;
         }
 